@@ -0,0 +1,84 @@
+import os
+import sys
+import time
+
+try:
+    import cv2
+    import numpy as np
+except ImportError:
+    print("bench_opencv.py: нужны opencv-python и numpy, сравнение с OpenCV пропущено")
+    sys.exit(0)
+
+
+def load_disparity(path):
+    # 16-битный PGM: диспаратность * 16, 0 - не найдена
+    return cv2.imread(path, cv2.IMREAD_UNCHANGED).astype(np.float32) / 16.0
+
+
+def compare(disparity, reference, valid):
+    # Доля плохих пикселей (ошибка > 1) и средняя ошибка по общим пикселям
+    if not valid.any():
+        return 0.0, 0.0
+    err = np.abs(disparity[valid] - reference[valid])
+    return 100.0 * np.mean(err > 1.0), float(np.mean(err))
+
+
+def compare_scene(bench_dir, name, num_disparities, block_size, pre_filter_cap,
+                  texture_threshold, uniqueness_ratio, matching_time):
+    left = cv2.imread(os.path.join(bench_dir, name + "_left.pgm"), cv2.IMREAD_GRAYSCALE)
+    right = cv2.imread(os.path.join(bench_dir, name + "_right.pgm"), cv2.IMREAD_GRAYSCALE)
+    ours = load_disparity(os.path.join(bench_dir, name + "_disp.pgm"))
+    gt = load_disparity(os.path.join(bench_dir, name + "_gt.pgm"))
+
+    # Те же параметры, что и у плагина (X-Sobel, без фильтрации пятен)
+    stereo = cv2.StereoBM_create(numDisparities=num_disparities, blockSize=block_size)
+    stereo.setPreFilterType(1)
+    stereo.setPreFilterCap(pre_filter_cap)
+    stereo.setTextureThreshold(texture_threshold)
+    stereo.setUniquenessRatio(uniqueness_ratio)
+    stereo.setSpeckleWindowSize(0)
+    stereo.setSpeckleRange(0)
+    stereo.setMinDisparity(0)
+
+    start = time.perf_counter()
+    cv_disp = stereo.compute(left, right)
+    cv_time = time.perf_counter() - start
+    cv_disp = cv_disp.astype(np.float32) / 16.0
+
+    ours_valid = ours > 0
+    cv_valid = cv_disp > 0
+    gt_valid = gt > 0
+
+    cv_bad, cv_err = compare(cv_disp, gt, cv_valid & gt_valid)
+    ours_bad, ours_err = compare(ours, gt, ours_valid & gt_valid)
+    diff_bad, diff_err = compare(ours, cv_disp, ours_valid & cv_valid)
+
+    mpix_disp = left.size * num_disparities / 1e6
+    print(f"{name:<16} | {mpix_disp / matching_time:9.1f} {mpix_disp / cv_time:9.1f} | "
+          f"{ours_bad:6.2f} {ours_err:6.3f} | {cv_bad:6.2f} {cv_err:6.3f} | "
+          f"{diff_bad:6.2f} {diff_err:6.3f} | {100.0 * np.mean(ours_valid):6.2f} "
+          f"{100.0 * np.mean(cv_valid):6.2f}")
+
+
+def main(bench_dir):
+    print(f"{'scene':<16} | {'Mpix*disp/s':>19} | {'ours vs gt':>13} | "
+          f"{'opencv vs gt':>13} | {'ours vs opencv':>13} | {'dense%':>13}")
+    print(f"{'':<16} | {'ours':>9} {'opencv':>9} | {'bad%':>6} {'err':>6} | "
+          f"{'bad%':>6} {'err':>6} | {'bad%':>6} {'err':>6} | {'ours':>6} {'opencv':>6}")
+
+    with open(os.path.join(bench_dir, "scenes.txt")) as scenes:
+        for line in scenes:
+            fields = line.split()
+            if not fields:
+                continue
+            compare_scene(bench_dir, fields[0], *map(int, fields[1:6]), float(fields[6]))
+
+    print("\nbad% = |d1 - d2| > 1 px по пикселям, где обе карты определены")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print("Использование: python bench_opencv.py <каталог stereobm-bench -o>")
+        sys.exit(1)
+
+    main(sys.argv[1])
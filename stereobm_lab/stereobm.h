@@ -4,25 +4,24 @@
 #include <libgimp/gimp.h>
 #include <libgimp/gimpui.h>
 
-typedef struct {
-  gint num_disparities;
-  gint block_size;
-  gint pre_filter_cap;
-  gint texture_threshold;
-  gint uniqueness_ratio;
-} StereoBMParams;
+#include "stereobm_core.h"
 
-gint compute_sad(const guchar *left_block, const guchar *right_block, 
-                gint block_size, gint block_width, gint pre_filter_cap);
-gint* stereobm_compute(const guchar *left_img, const guchar *right_img,
-                      gint width, gint height, StereoBMParams *params);
-void normalize_disparity_map(gint *disparity_map, guchar *output, 
-                           gint width, gint height, gint num_disparities);
-void stereobm_plugin(GimpProcedure *procedure, GimpDrawable *drawable, 
-                    StereoBMParams *params);
-gboolean stereobm_dialog(StereoBMParams *params);
+// Вид результата плагина. Серый и 16-битный варианты - сама диспаратность,
+// без нормализации и цветового кодирования (для дальнейшей обработки).
+typedef enum {
+  STEREOBM_OUTPUT_COLOR = 0,  // цветовая шкала по диапазону найденных диспаратностей
+  STEREOBM_OUTPUT_GRAY,       // 8 бит: диспаратность в пикселях, 0 - не найдена
+  STEREOBM_OUTPUT_RAW16       // 16 бит (линейные): диспаратность * 16, как в stereobm-cli
+} StereoBMOutput;
 
-void normalize_disparity_map_color(gint *disparity_map, guchar *output, 
-                                 gint width, gint height, gint num_disparities);
+GimpImage *stereobm_plugin(GimpProcedure *procedure, GimpDrawable *drawable,
+                           const StereoBMParams *params, StereoBMOutput output,
+                           GimpRunMode run_mode, GError **error);
+gboolean stereobm_dialog(GimpDrawable *drawable, StereoBMParams *params, StereoBMOutput *output);
 
-#endif
\ No newline at end of file
+// Пакетная обработка side-by-side кадров из файлов (stereobm_batch.c):
+// возвращает число записанных карт, *failed - число ошибок
+gint stereobm_batch(const gchar *const *paths, const gchar *output_dir,
+                    const StereoBMParams *params, gint *failed);
+
+#endif
@@ -0,0 +1,164 @@
+#include "stereobm.h"
+#include "stereobm_io.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Пакетная обработка: side-by-side кадры читаются из файлов (stereobm_io),
+// изображения GIMP и окна не создаются. Параллелизм - по кадрам: каждый
+// рабочий поток считает свой кадр в одном потоке ядра, так что потоки
+// не синхронизируются внутри кадра и не делят буферы. Буферы кадра берутся
+// из контекста (StereoBMContext), который поток получает из очереди и
+// возвращает после кадра: контекстов не больше, чем рабочих потоков, и
+// кадры одного размера считаются без новых выделений памяти.
+
+typedef struct {
+  StereoBMParams params;       // num_threads = 1 (поток на кадр)
+  GAsyncQueue *contexts;       // свободные StereoBMContext
+
+  GMutex mutex;
+  GCond cond;
+  gint done;                   // защищены mutex
+  gint failed;
+} StereoBMBatch;
+
+typedef struct {
+  const gchar *path;
+  gchar *output_path;          // <output_dir>/<кадр>_disp.pgm
+} StereoBMBatchFrame;
+
+// Имя карты: базовое имя кадра без расширения + "_disp.pgm"
+static gchar *batch_output_path(const gchar *path, const gchar *output_dir) {
+  gchar *name = g_path_get_basename(path);
+  gchar *dot = strrchr(name, '.');
+  if (dot && dot != name)
+    *dot = '\0';
+  gchar *file_name = g_strconcat(name, "_disp.pgm", NULL);
+  gchar *output_path = g_build_filename(output_dir, file_name, NULL);
+
+  g_free(name);
+  g_free(file_name);
+  return output_path;
+}
+
+// Один кадр: загрузка, фильтрация, поиск, запись карты
+static gboolean batch_frame(const StereoBMBatchFrame *frame, const StereoBMBatch *batch,
+                            StereoBMContext *context) {
+  const gchar *path = frame->path;
+  StereoBMImage image;
+
+  if (stereobm_image_load(path, &image))
+    return FALSE;
+  if (image.width % 2 != 0) {
+    g_printerr("%s: side-by-side image must have even width\n", path);
+    stereobm_image_free(&image);
+    return FALSE;
+  }
+
+  gint width = image.width / 2;
+  gint height = image.height;
+  const gint16 *disparity_map =
+    stereobm_context_compute(context, image.data, image.data + (gsize)width * image.channels,
+                             (gsize)image.width * image.channels, image.channels, width, height,
+                             &batch->params, NULL, NULL, NULL);
+  stereobm_image_free(&image);
+  if (!disparity_map) {
+    g_printerr("%s: out of memory\n", path);
+    return FALSE;
+  }
+
+  return stereobm_write_disparity(frame->output_path, disparity_map, width, height) == 0;
+}
+
+static void batch_worker(gpointer data, gpointer user_data) {
+  StereoBMBatch *batch = user_data;
+  StereoBMContext *context = g_async_queue_pop(batch->contexts);
+  gboolean ok = batch_frame(data, batch, context);
+
+  g_async_queue_push(batch->contexts, context);
+
+  g_mutex_lock(&batch->mutex);
+  batch->done++;
+  if (!ok)
+    batch->failed++;
+  g_cond_signal(&batch->cond);
+  g_mutex_unlock(&batch->mutex);
+}
+
+gint stereobm_batch(const gchar *const *paths, const gchar *output_dir,
+                    const StereoBMParams *params, gint *failed) {
+  gint total = paths ? (gint)g_strv_length((gchar **)paths) : 0;
+  StereoBMBatch batch;
+
+  *failed = 0;
+  if (total == 0)
+    return 0;
+
+  batch.params = *params;
+  batch.params.num_threads = 1;
+  batch.done = 0;
+  batch.failed = 0;
+  g_mutex_init(&batch.mutex);
+  g_cond_init(&batch.cond);
+
+  // Число рабочих потоков: num_threads (0 - по числу процессоров)
+  gint num_workers = params->num_threads > 0 ? params->num_threads : (gint)g_get_num_processors();
+  num_workers = CLAMP(num_workers, 1, total);
+
+  batch.contexts = g_async_queue_new_full((GDestroyNotify)stereobm_context_free);
+  for (gint i = 0; i < num_workers; i++)
+    g_async_queue_push(batch.contexts, stereobm_context_new());
+
+  GThreadPool *pool = g_thread_pool_new(batch_worker, &batch, num_workers, TRUE, NULL);
+
+  // Имена карт строятся до запуска потоков: кадры с одинаковым именем
+  // без расширения (a/f.png и b/f.png, f.png и f.pgm) записали бы одну
+  // карту из разных потоков. Такой кадр не считается и идёт в failed,
+  // карту пишет первый из них.
+  StereoBMBatchFrame *frames = g_new(StereoBMBatchFrame, total);
+  GHashTable *outputs = g_hash_table_new(g_str_hash, g_str_equal);
+
+  gimp_progress_init("Computing disparity maps...");
+  for (gint i = 0; i < total; i++) {
+    frames[i].path = paths[i];
+    frames[i].output_path = batch_output_path(paths[i], output_dir);
+
+    const gchar *first = g_hash_table_lookup(outputs, frames[i].output_path);
+    if (first) {
+      g_printerr("%s: output %s is already written for %s\n", paths[i],
+                 frames[i].output_path, first);
+      g_mutex_lock(&batch.mutex);
+      batch.done++;
+      batch.failed++;
+      g_mutex_unlock(&batch.mutex);
+      continue;
+    }
+    g_hash_table_insert(outputs, frames[i].output_path, (gpointer)paths[i]);
+    g_thread_pool_push(pool, &frames[i], NULL);
+  }
+
+  // Прогресс сообщается только из основного потока
+  g_mutex_lock(&batch.mutex);
+  while (batch.done < total) {
+    g_cond_wait_until(&batch.cond, &batch.mutex,
+                      g_get_monotonic_time() + 100 * G_TIME_SPAN_MILLISECOND);
+    gint done = batch.done;
+    g_mutex_unlock(&batch.mutex);
+    gimp_progress_update((gdouble)done / total);
+    g_mutex_lock(&batch.mutex);
+  }
+  g_mutex_unlock(&batch.mutex);
+
+  g_thread_pool_free(pool, FALSE, TRUE);
+  gimp_progress_update(1.0);
+
+  g_hash_table_destroy(outputs);
+  for (gint i = 0; i < total; i++)
+    g_free(frames[i].output_path);
+  g_free(frames);
+  g_async_queue_unref(batch.contexts);
+  g_mutex_clear(&batch.mutex);
+  g_cond_clear(&batch.cond);
+
+  *failed = batch.failed;
+  return total - batch.failed;
+}
@@ -0,0 +1,576 @@
+#include "stereobm_core.h"
+#include "stereobm_io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Бенчмарк и проверка точности libstereobm на синтетических стереопарах
+// (random-dot stereogram с известной диспаратностью). Результаты и пары
+// сохраняются в каталог для сравнения с cv2.StereoBM (bench_opencv.py).
+
+typedef enum {
+  SCENE_PLANES,   // фон и две фронтальные плоскости
+  SCENE_RAMP      // ступенчатый наклон диспаратности по x
+} SceneKind;
+
+typedef struct {
+  const char *name;
+  SceneKind kind;
+  int width;
+  int height;
+  int num_disparities;
+} BenchScene;
+
+static const BenchScene scenes[] = {
+  { "planes_640x480",  SCENE_PLANES, 640,  480, 64 },
+  { "ramp_640x480",    SCENE_RAMP,   640,  480, 64 },
+  { "planes_1280x720", SCENE_PLANES, 1280, 720, 128 },
+};
+
+// Время стадий, с
+typedef struct {
+  double prefilter;       // разделение + градации серого + X-Sobel
+  double texture;
+  double matching;
+  double normalize;
+  long long llc_misses;   // промахи LLC при сопоставлении, -1 - счетчик недоступен
+} BenchTimes;
+
+// Счетчик промахов последнего уровня кэша для процесса и потоков, созданных
+// после открытия (потоки сопоставления), только user space. -1 - недоступен
+// (нет PMU в виртуальной машине, perf_event_paranoid и т.п.)
+static int llc_counter_open(void) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void llc_counter_start(int fd) {
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+static long long llc_counter_stop(int fd) {
+  long long count;
+
+  if (fd < 0)
+    return -1;
+  ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  return read(fd, &count, sizeof(count)) == sizeof(count) ? count : -1;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Сдвиг круга сцены SCENE_PLANES за кадр последовательности, пикселей
+#define SCENE_MOTION 2
+
+// Истинная диспаратность сцены (в пикселях, для левого изображения)
+// в кадре frame (круг сдвигается влево на SCENE_MOTION пикселей за кадр)
+static int scene_disparity(const BenchScene *scene, int frame, int x, int y) {
+  int w = scene->width, h = scene->height, nd = scene->num_disparities;
+
+  if (scene->kind == SCENE_RAMP)
+    return nd / 8 + (int)((long)(nd * 3 / 4) * x / w);
+
+  int dx = x - w * 2 / 3 + frame * SCENE_MOTION, dy = y - h / 2;
+  if (dx * dx + dy * dy < (h / 5) * (h / 5))
+    return nd * 3 / 4;
+  if (x > w / 6 && x < w / 2 && y > h / 4 && y < h * 3 / 4)
+    return nd / 2;
+  return nd / 5;
+}
+
+// Генерация пары: правое изображение - случайные точки (блоки 2x2, чтобы
+// спектр был ближе к реальным снимкам), левое - сдвиг правого на истинную
+// диспаратность
+static void scene_generate(const BenchScene *scene, int frame, uint8_t *left, uint8_t *right,
+                           int *gt) {
+  int w = scene->width, h = scene->height;
+  unsigned int seed = 12345;
+
+  for (int y = 0; y < h; y++)
+    for (int x = 0; x < w; x++) {
+      if (y % 2 == 0 && x % 2 == 0) {
+        seed = seed * 1103515245u + 12345u;
+        right[y * w + x] = (uint8_t)(seed >> 16);
+      } else {
+        right[y * w + x] = right[(y - y % 2) * w + (x - x % 2)];
+      }
+    }
+
+  for (int y = 0; y < h; y++)
+    for (int x = 0; x < w; x++) {
+      int d = scene_disparity(scene, frame, x, y);
+      gt[y * w + x] = d;
+      if (x - d >= 0) {
+        left[y * w + x] = right[y * w + x - d];
+      } else {
+        seed = seed * 1103515245u + 12345u;
+        left[y * w + x] = (uint8_t)(seed >> 16);
+        gt[y * w + x] = -1;
+      }
+    }
+}
+
+static int write_pgm8(const char *path, const uint8_t *data, int width, int height) {
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  fprintf(f, "P5\n%d %d\n255\n", width, height);
+  fwrite(data, 1, (size_t)width * height, f);
+  return fclose(f);
+}
+
+// Точность относительно истинной карты: доля плохих пикселей (ошибка > 1)
+// и средняя ошибка по пикселям с найденной диспаратностью
+static void evaluate(const int16_t *disparity_map, const int *gt, int n,
+                     double *bad_percent, double *mean_error, double *density) {
+  long valid = 0, with_gt = 0, bad = 0;
+  double err_sum = 0;
+
+  for (int i = 0; i < n; i++) {
+    if (gt[i] < 0)
+      continue;
+    with_gt++;
+    if (disparity_map[i] <= 0)
+      continue;
+    double err = fabs((double)disparity_map[i] / STEREOBM_DISP_SCALE - gt[i]);
+    valid++;
+    err_sum += err;
+    if (err > 1.0)
+      bad++;
+  }
+
+  *bad_percent = valid ? 100.0 * bad / valid : 0;
+  *mean_error = valid ? err_sum / valid : 0;
+  *density = with_gt ? 100.0 * valid / with_gt : 0;
+}
+
+// Прогон стадий для одной сцены с минимумом времени по повторам;
+// disparity_map - результат последнего повтора (освобождает вызывающий)
+static int16_t *bench_run(const StereoBMParams *params, int w, int h, const uint8_t *sbs,
+                          int repeats, BenchTimes *best) {
+  size_t n = (size_t)w * h;
+  uint8_t *left_filtered = malloc(n), *right_filtered = malloc(n);
+  uint8_t *mask = malloc(n), *color = malloc(n * 3);
+  int16_t *disparity_map = NULL;
+
+  int llc_fd = llc_counter_open();
+
+  *best = (BenchTimes){ INFINITY, INFINITY, INFINITY, INFINITY, -1 };
+
+  for (int r = 0; r < repeats; r++) {
+    double t1 = now();
+    stereobm_prefilter_sbs(sbs, w * 2, h, 3, params->pre_filter_cap,
+                           left_filtered, right_filtered);
+    double t2 = now();
+    stereobm_texture_mask(left_filtered, w, h, params, mask);
+    double t3 = now();
+    free(disparity_map);
+    llc_counter_start(llc_fd);
+    disparity_map = stereobm_compute_filtered(left_filtered, right_filtered, w, h,
+                                              params, NULL, NULL, NULL);
+    long long llc_misses = llc_counter_stop(llc_fd);
+    double t4 = now();
+    normalize_disparity_map_color(disparity_map, color, w, h, params->num_disparities);
+    double t5 = now();
+
+    best->prefilter = fmin(best->prefilter, t2 - t1);
+    best->texture = fmin(best->texture, t3 - t2);
+    best->matching = fmin(best->matching, t4 - t3);
+    best->normalize = fmin(best->normalize, t5 - t4);
+    if (llc_misses >= 0 && (best->llc_misses < 0 || llc_misses < best->llc_misses))
+      best->llc_misses = llc_misses;
+  }
+
+  if (llc_fd >= 0)
+    close(llc_fd);
+  free(left_filtered);
+  free(right_filtered);
+  free(mask);
+  free(color);
+  return disparity_map;
+}
+
+static void bench_print(const BenchScene *scene, const StereoBMParams *params,
+                        const BenchTimes *best, const int16_t *disparity_map, const int *gt) {
+  size_t n = (size_t)scene->width * scene->height;
+  double bad, err, density;
+  char mode[16];
+
+  // pyr: уровни пирамиды, "a" - автоматический диапазон, "lN" - LR-проверка
+  if (params->auto_range)
+    snprintf(mode, sizeof(mode), "a");
+  else if (params->disp12_max_diff >= 0)
+    snprintf(mode, sizeof(mode), "l%d", params->disp12_max_diff);
+  else
+    snprintf(mode, sizeof(mode), "%d", params->pyramid_levels);
+  char llc[16] = "-";
+  if (best->llc_misses >= 0)
+    snprintf(llc, sizeof(llc), "%.3f", (double)best->llc_misses / n);
+
+  evaluate(disparity_map, gt, (int)n, &bad, &err, &density);
+  printf("%-16s %4d %3s | %12.2f %7.2f %8.2f %7.2f    | %11.1f %10s %5d | %6.2f %6.3f %7.2f\n",
+         scene->name, params->num_disparities, mode,
+         best->prefilter * 1e3, best->texture * 1e3,
+         best->matching * 1e3, best->normalize * 1e3,
+         (double)n * params->num_disparities / best->matching / 1e6,
+         llc, stereobm_tile_width(params, scene->width), bad, err, density);
+}
+
+// Время ядра SAD по всем пикселям с полным диапазоном диспаратностей, с
+static double bench_kernel(StereoBMMatchFunc match_func, const uint8_t *left_filtered,
+                           const uint8_t *right_filtered, int w, int h, int nd,
+                           int half_block, int repeats, long *checksum) {
+  double best = INFINITY;
+
+  for (int r = 0; r < repeats; r++) {
+    long sum = 0;
+    double t1 = now();
+    for (int y = half_block; y < h - half_block; y++)
+      for (int x = half_block + nd - 1; x < w - half_block; x++) {
+        StereoBMMatch match = { 0, INT_MAX, INT_MAX };
+        match_func(left_filtered, right_filtered, w, x, y, half_block, 0, nd, &match);
+        sum += match.best_disparity + match.second_best_cost;
+      }
+    best = fmin(best, now() - t1);
+    *checksum = sum;
+  }
+  return best;
+}
+
+// Специализированные ядра (окно развернуто при компиляции) против обобщенного
+// цикла для всех размеров блока диалога
+static void bench_kernels(const BenchScene *scene, const StereoBMParams *base, int repeats) {
+  int w = scene->width, h = scene->height, nd = scene->num_disparities;
+  size_t n = (size_t)w * h;
+  uint8_t *left = malloc(n), *right = malloc(n), *sbs = malloc(n * 2);
+  uint8_t *left_filtered = malloc(n), *right_filtered = malloc(n);
+  int *gt = malloc(n * sizeof(int));
+
+  scene_generate(scene, 0, left, right, gt);
+  for (int y = 0; y < h; y++) {
+    memcpy(sbs + (size_t)y * 2 * w, left + (size_t)y * w, w);
+    memcpy(sbs + (size_t)y * 2 * w + w, right + (size_t)y * w, w);
+  }
+  stereobm_prefilter_sbs(sbs, w * 2, h, 1, base->pre_filter_cap, left_filtered, right_filtered);
+
+  printf("\n%s, %d disparities, SAD kernel only\n", scene->name, nd);
+  printf("%5s | %8s %11s ms | %7s\n", "block", "generic", "specialized", "speedup");
+  for (int block_size = 3; block_size <= 21; block_size += 2) {
+    StereoBMParams params = *base;
+    params.block_size = block_size;
+    params.num_disparities = nd;
+
+    long sum_generic, sum_specialized;
+    double generic = bench_kernel(stereobm_select_generic_match_func(&params),
+                                  left_filtered, right_filtered, w, h, nd,
+                                  block_size / 2, repeats, &sum_generic);
+    double specialized = bench_kernel(stereobm_select_match_func(&params),
+                                      left_filtered, right_filtered, w, h, nd,
+                                      block_size / 2, repeats, &sum_specialized);
+    printf("%5d | %8.2f %11.2f    | %6.2fx%s\n", block_size, generic * 1e3, specialized * 1e3,
+           generic / specialized, sum_generic == sum_specialized ? "" : "  MISMATCH");
+  }
+
+  free(left);
+  free(right);
+  free(sbs);
+  free(left_filtered);
+  free(right_filtered);
+  free(gt);
+}
+
+// Последовательность кадров: вычисление каждого кадра заново (как запуск
+// плагина на кадр), то же с StereoBMContext (буферы переиспользуются между
+// кадрами), StereoBMSequence с полным поиском и с временным prior
+static void bench_sequence(const BenchScene *scene, const StereoBMParams *base, int frames,
+                           int temporal_radius, int refresh_interval) {
+  int w = scene->width, h = scene->height;
+  size_t n = (size_t)w * h;
+  uint8_t *left = malloc(n * frames), *right = malloc(n * frames);
+  int *gt = malloc(n * frames * sizeof(int));
+  StereoBMParams params = *base;
+  params.num_disparities = scene->num_disparities;
+
+  for (int f = 0; f < frames; f++)
+    scene_generate(scene, f, left + n * f, right + n * f, gt + n * f);
+
+  printf("\n%s sequence, %d frames, circle moving %d px/frame\n",
+         scene->name, frames, SCENE_MOTION);
+  printf("%-28s | %8s | %6s %6s %7s\n", "mode", "frames/s", "bad%", "err", "dense%");
+
+  for (int mode = 0; mode < 4; mode++) {
+    double bad_sum = 0, err_sum = 0, density_sum = 0;
+    double elapsed = 0;
+    StereoBMSequence *sequence = NULL;
+    StereoBMContext *context = mode == 1 ? stereobm_context_new() : NULL;
+
+    if (mode > 1)
+      sequence = stereobm_sequence_new(w, h, &params, mode == 3 ? temporal_radius : 0,
+                                       refresh_interval);
+
+    for (int f = 0; f < frames; f++) {
+      const uint8_t *l = left + n * f, *r = right + n * f;
+      int16_t *owned = NULL;
+      const int16_t *disparity_map;
+      double t1 = now();
+
+      if (sequence) {
+        disparity_map = stereobm_sequence_frame(sequence, l, r, w, 1);
+      } else if (context) {
+        disparity_map = stereobm_context_compute(context, l, r, w, 1, w, h, &params,
+                                                 NULL, NULL, NULL);
+      } else {
+        owned = stereobm_compute(l, r, w, h, &params, NULL, NULL);
+        disparity_map = owned;
+      }
+      elapsed += now() - t1;
+
+      double bad, err, density;
+      evaluate(disparity_map, gt + n * f, (int)n, &bad, &err, &density);
+      bad_sum += bad;
+      err_sum += err;
+      density_sum += density;
+      free(owned);
+    }
+    stereobm_sequence_free(sequence);
+    stereobm_context_free(context);
+
+    char name[64];
+    if (mode == 0)
+      snprintf(name, sizeof(name), "per-frame compute");
+    else if (mode == 1)
+      snprintf(name, sizeof(name), "per-frame, context");
+    else if (mode == 2)
+      snprintf(name, sizeof(name), "sequence, full search");
+    else
+      snprintf(name, sizeof(name), "sequence, prior r=%d every=%d", temporal_radius,
+               refresh_interval);
+    printf("%-28s | %8.2f | %6.2f %6.3f %7.2f\n", name, frames / elapsed,
+           bad_sum / frames, err_sum / frames, density_sum / frames);
+  }
+
+  free(left);
+  free(right);
+  free(gt);
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -b N   block size, default 15\n"
+          "  -c N   pre filter cap, default 31\n"
+          "  -t N   texture threshold, default 10\n"
+          "  -u N   uniqueness ratio, default 15\n"
+          "  -j N   threads (0 = number of processors), default 0\n"
+          "  -L N   L2 size in KiB for column tiles (0 = detect, -1 = no tiles), default 0\n"
+          "  -p N   pyramid levels compared with full search (0 = off), default 2\n"
+          "  -k N   pyramid search radius, default 3\n"
+          "  -a     also run with the automatic disparity range\n"
+          "  -l N   also run with the left-right check, max difference N (-1 = off), default -1\n"
+          "  -m M   matching cost: sad, census5 or census7, default sad\n"
+          "  -s N   semi-global matching paths (0 = block matching, 4 or 8), default 0\n"
+          "  -1 N   SGM penalty P1 per window pixel, default 8\n"
+          "  -2 N   SGM penalty P2 per window pixel, default 32\n"
+          "  -r N   repeats per stage (minimum is reported), default 3\n"
+          "  -o DIR write pairs and disparity maps for bench_opencv.py\n"
+          "  -g     compare block-size specialized SAD kernels with the generic one\n"
+          "  -f N   frames in the sequence (video) test, 0 = off, default 30\n"
+          "  -w N   sequence temporal prior radius, default 4\n"
+          "  -e N   sequence full-search refresh interval (0 = first frame only), default 10\n",
+          prog);
+}
+
+int main(int argc, char **argv) {
+  StereoBMParams base;
+  const char *out_dir = NULL;
+  int pyramid_levels = 2;
+  int auto_range = 0;
+  int disp12_max_diff = -1;
+  int repeats = 3;
+  int kernels = 0;
+  int frames = 30, temporal_radius = 4, refresh_interval = 10;
+  int opt;
+
+  stereobm_params_init(&base);
+
+  while ((opt = getopt(argc, argv, "b:c:t:u:j:L:p:k:al:m:s:1:2:r:o:gf:w:e:h")) != -1) {
+    switch (opt) {
+      case 'b': base.block_size = atoi(optarg); break;
+      case 'c': base.pre_filter_cap = atoi(optarg); break;
+      case 't': base.texture_threshold = atoi(optarg); break;
+      case 'u': base.uniqueness_ratio = atoi(optarg); break;
+      case 'j': base.num_threads = atoi(optarg); break;
+      case 'L': base.cache_bytes = atoi(optarg) > 0 ? atoi(optarg) * 1024 : atoi(optarg); break;
+      case 'p': pyramid_levels = atoi(optarg); break;
+      case 'k': base.pyramid_radius = atoi(optarg); break;
+      case 'a': auto_range = 1; break;
+      case 'l': disp12_max_diff = atoi(optarg); break;
+      case 'm':
+        if (stereobm_parse_cost(optarg, &base.cost_type)) {
+          fprintf(stderr, "%s: unknown matching cost '%s'\n", argv[0], optarg);
+          return 2;
+        }
+        break;
+      case 's': base.sgm_paths = atoi(optarg); break;
+      case '1': base.sgm_p1 = atoi(optarg); break;
+      case '2': base.sgm_p2 = atoi(optarg); break;
+      case 'r': repeats = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+      case 'o': out_dir = optarg; break;
+      case 'g': kernels = 1; break;
+      case 'f': frames = atoi(optarg); break;
+      case 'w': temporal_radius = atoi(optarg); break;
+      case 'e': refresh_interval = atoi(optarg); break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  FILE *list = NULL;
+  if (out_dir) {
+    char path[1024];
+    mkdir(out_dir, 0755);
+    snprintf(path, sizeof(path), "%s/scenes.txt", out_dir);
+    list = fopen(path, "w");
+    if (!list) {
+      perror(path);
+      return 1;
+    }
+  }
+
+  printf("block_size=%d pre_filter_cap=%d texture_threshold=%d uniqueness_ratio=%d threads=%d "
+         "pyramid_radius=%d cost=%s sgm_paths=%d p1=%d p2=%d\n\n",
+         base.block_size, base.pre_filter_cap, base.texture_threshold,
+         base.uniqueness_ratio, base.num_threads, base.pyramid_radius,
+         stereobm_cost_name(base.cost_type), base.sgm_paths, base.sgm_p1, base.sgm_p2);
+  printf("%-16s %4s %3s | %12s %7s %8s %7s ms | %11s %10s %5s | %6s %6s %7s\n",
+         "scene", "disp", "pyr", "split+filter", "texture", "matching", "norm",
+         "Mpix*disp/s", "LLC miss/px", "tile", "bad%", "err", "dense%");
+
+  for (size_t s = 0; s < sizeof(scenes) / sizeof(scenes[0]); s++) {
+    const BenchScene *scene = &scenes[s];
+    int w = scene->width, h = scene->height;
+    size_t n = (size_t)w * h;
+    StereoBMParams params = base;
+    params.num_disparities = scene->num_disparities;
+    params.pyramid_levels = 0;
+
+    uint8_t *left = malloc(n), *right = malloc(n);
+    uint8_t *sbs = malloc(n * 2 * 3);
+    int *gt = malloc(n * sizeof(int));
+    BenchTimes best;
+
+    scene_generate(scene, 0, left, right, gt);
+
+    // side-by-side RGB для совмещенной стадии разделения и фильтрации
+    for (int y = 0; y < h; y++)
+      for (int x = 0; x < w; x++)
+        for (int c = 0; c < 3; c++) {
+          sbs[((size_t)y * 2 * w + x) * 3 + c] = left[y * w + x];
+          sbs[((size_t)y * 2 * w + x + w) * 3 + c] = right[y * w + x];
+        }
+
+    // Полный поиск
+    int16_t *disparity_map = bench_run(&params, w, h, sbs, repeats, &best);
+    bench_print(scene, &params, &best, disparity_map, gt);
+
+    if (out_dir) {
+      char path[1024];
+      snprintf(path, sizeof(path), "%s/%s_left.pgm", out_dir, scene->name);
+      write_pgm8(path, left, w, h);
+      snprintf(path, sizeof(path), "%s/%s_right.pgm", out_dir, scene->name);
+      write_pgm8(path, right, w, h);
+      snprintf(path, sizeof(path), "%s/%s_disp.pgm", out_dir, scene->name);
+      stereobm_write_disparity(path, disparity_map, w, h);
+
+      fprintf(list, "%s %d %d %d %d %d %.6f\n", scene->name,
+              params.num_disparities, params.block_size, params.pre_filter_cap,
+              params.texture_threshold, params.uniqueness_ratio, best.matching);
+    }
+    free(disparity_map);
+
+    // Автоматический диапазон внутри того же заданного
+    if (auto_range) {
+      params.auto_range = 1;
+      disparity_map = bench_run(&params, w, h, sbs, repeats, &best);
+      bench_print(scene, &params, &best, disparity_map, gt);
+      free(disparity_map);
+      params.auto_range = 0;
+    }
+
+    // LR-проверка: правый вид из того же объема стоимостей
+    if (disp12_max_diff >= 0) {
+      params.disp12_max_diff = disp12_max_diff;
+      disparity_map = bench_run(&params, w, h, sbs, repeats, &best);
+      bench_print(scene, &params, &best, disparity_map, gt);
+      free(disparity_map);
+      params.disp12_max_diff = -1;
+    }
+
+    // Пирамида с тем же набором параметров
+    if (pyramid_levels > 0) {
+      params.pyramid_levels = pyramid_levels;
+      disparity_map = bench_run(&params, w, h, sbs, repeats, &best);
+      bench_print(scene, &params, &best, disparity_map, gt);
+      free(disparity_map);
+    }
+
+    if (out_dir) {
+      // Истинная карта в формате результата
+      int16_t *gt_map = malloc(n * sizeof(int16_t));
+      char path[1024];
+      for (size_t i = 0; i < n; i++)
+        gt_map[i] = (int16_t)(gt[i] < 0 ? 0 : gt[i] * STEREOBM_DISP_SCALE);
+      snprintf(path, sizeof(path), "%s/%s_gt.pgm", out_dir, scene->name);
+      stereobm_write_disparity(path, gt_map, w, h);
+      free(gt_map);
+    }
+
+    free(left);
+    free(right);
+    free(sbs);
+    free(gt);
+  }
+
+  if (list)
+    fclose(list);
+
+  printf("\nmatching includes its own texture pass; bad%% = |d - gt| > 1 px over pixels\n"
+         "with a disparity, dense%% = share of pixels with a disparity; pyr > 0 rows use\n"
+         "coarse-to-fine search, pyr = a rows the automatic range, lN rows the left-right\n"
+         "check, Mpix*disp/s is given for the full disparity range; LLC miss/px - last level\n"
+         "cache misses of the matching stage per pixel (- without a hardware counter), tile -\n"
+         "column tile width (the image width - no tiles, -L sets the L2 size)\n");
+
+  if (frames > 0)
+    bench_sequence(&scenes[0], &base, frames, temporal_radius, refresh_interval);
+  if (kernels)
+    bench_kernels(&scenes[0], &base, repeats);
+  return 0;
+}
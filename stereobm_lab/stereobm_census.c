@@ -0,0 +1,275 @@
+#include "stereobm_core.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define STEREOBM_HAVE_X86 1
+#endif
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define CLAMP(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
+
+// Census: бит на каждого соседа окна (кроме центра), 1 - сосед меньше центра.
+// Дескриптор зависит только от порядка яркостей, поэтому разница экспозиций
+// камер на стоимость не влияет.
+
+// Полуразмеры окна census (по вертикали и горизонтали)
+static void census_radius(StereoBMCostType cost_type, int *ry, int *rx) {
+  if (cost_type == STEREOBM_COST_CENSUS_7X9) {
+    *ry = 3;
+    *rx = 4;
+  } else if (cost_type == STEREOBM_COST_CENSUS_5X5) {
+    *ry = 2;
+    *rx = 2;
+  } else {
+    *ry = 0;
+    *rx = 0;
+  }
+}
+
+// Поле с грубыми уровнями пирамиды: уровень ищется по своему полю (плюс
+// extra) вокруг строк или столбцов окрестности 3x3 guide_range(),
+// выровненных по 2, - в масштабе текущего уровня это 2 * (margin + extra) + 3
+static int pyramid_margin(int margin, int extra, int levels) {
+  for (int level = 0; level < levels; level++)
+    margin = 2 * (margin + extra) + 3;
+  return margin;
+}
+
+// Строки контекста сверху и снизу полосы, нужные stereobm_compute_band()
+int stereobm_band_margin(const StereoBMParams *params) {
+  int ry, rx;
+
+  census_radius(params->cost_type, &ry, &rx);
+  return pyramid_margin(params->block_size / 2 + ry, 0, params->pyramid_levels);
+}
+
+// Столбцы контекста слева и справа области карты (без диапазона диспаратностей).
+// Грубому уровню, как и области, нужен еще столбец справа: у последних
+// half_block + 1 столбцов изображения диапазон диспаратностей сужается
+int stereobm_column_margin(const StereoBMParams *params) {
+  int ry, rx;
+
+  census_radius(params->cost_type, &ry, &rx);
+  return pyramid_margin(params->block_size / 2 + rx, 1, params->pyramid_levels);
+}
+
+// Дескрипторы строк [y_begin, y_end); соседи за краем изображения берутся
+// с ближайшей строки/столбца
+void stereobm_census_rows(const uint8_t *image, int width, int height, int row_offset,
+                          int y_begin, int y_end, StereoBMCostType cost_type,
+                          uint64_t *output) {
+  int ry, rx;
+  census_radius(cost_type, &ry, &rx);
+
+  int x_first = MIN(rx, width), x_last = MAX(width - rx, x_first);
+
+  for (int y = y_begin; y < y_end; y++) {
+    const uint8_t *center = image + (size_t)(y - row_offset) * width;
+    uint64_t *desc = output + (size_t)(y - y_begin) * width;
+
+    memset(desc, 0, width * sizeof(uint64_t));
+    for (int dy = -ry; dy <= ry; dy++) {
+      const uint8_t *row = image + (size_t)(CLAMP(y + dy, 0, height - 1) - row_offset) * width;
+      for (int dx = -rx; dx <= rx; dx++) {
+        if (dy == 0 && dx == 0)
+          continue;
+
+        // Внутренняя часть строки без проверки границ (векторизуется)
+        for (int x = x_first; x < x_last; x++)
+          desc[x] = (desc[x] << 1) | (row[x + dx] < center[x]);
+
+        for (int x = 0; x < x_first; x++)
+          desc[x] = (desc[x] << 1) | (row[CLAMP(x + dx, 0, width - 1)] < center[x]);
+        for (int x = x_last; x < width; x++)
+          desc[x] = (desc[x] << 1) | (row[CLAMP(x + dx, 0, width - 1)] < center[x]);
+      }
+    }
+  }
+}
+
+// Сдвиг вертикального окна: col_cost[(x - x_begin) * nd + k] += H(left_add[x],
+// right_add[x - d]) - H(left_sub[x], right_sub[x - d]) для x из [x_begin, x_end)
+// и d = min_disparity + k <= x (H - расстояние Хэмминга). Суммы в uint16:
+// block_size^2 * 62 < 65536 для block_size <= 21.
+static inline __attribute__((always_inline))
+void census_slide_body(const uint64_t *left_add, const uint64_t *right_add,
+                       const uint64_t *left_sub, const uint64_t *right_sub,
+                       int x_begin, int x_end, int min_disparity, int num_disparities,
+                       uint16_t *col_cost) {
+  for (int x = MAX(x_begin, min_disparity); x < x_end; x++) {
+    uint16_t *cost = col_cost + (size_t)(x - x_begin) * num_disparities;
+    int k_end = MIN(num_disparities, x - min_disparity + 1);
+    const uint64_t *ra = right_add + x - min_disparity;
+    uint64_t la = left_add[x];
+
+    if (left_sub) {
+      const uint64_t *rs = right_sub + x - min_disparity;
+      uint64_t ls = left_sub[x];
+      for (int k = 0; k < k_end; k++)
+        cost[k] += __builtin_popcountll(la ^ ra[-k]) - __builtin_popcountll(ls ^ rs[-k]);
+    } else {
+      for (int k = 0; k < k_end; k++)
+        cost[k] += __builtin_popcountll(la ^ ra[-k]);
+    }
+  }
+}
+
+void stereobm_census_slide_scalar(const uint64_t *left_add, const uint64_t *right_add,
+                                  const uint64_t *left_sub, const uint64_t *right_sub,
+                                  int x_begin, int x_end, int min_disparity,
+                                  int num_disparities, uint16_t *col_cost) {
+  census_slide_body(left_add, right_add, left_sub, right_sub, x_begin, x_end, min_disparity,
+                    num_disparities, col_cost);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// То же с аппаратной инструкцией POPCNT (без нее __builtin_popcountll -
+// табличная функция libgcc)
+__attribute__((target("popcnt")))
+void stereobm_census_slide_popcnt(const uint64_t *left_add, const uint64_t *right_add,
+                                  const uint64_t *left_sub, const uint64_t *right_sub,
+                                  int x_begin, int x_end, int min_disparity,
+                                  int num_disparities, uint16_t *col_cost) {
+  census_slide_body(left_add, right_add, left_sub, right_sub, x_begin, x_end, min_disparity,
+                    num_disparities, col_cost);
+}
+#endif
+
+// SAD-аналог stereobm_census_slide_*: по абсолютным разностям отфильтрованных
+// пикселей (суммы окна до 21^2 * 126 < 65536)
+void stereobm_sad_slide(const uint8_t *left_add, const uint8_t *right_add,
+                        const uint8_t *left_sub, const uint8_t *right_sub,
+                        int x_begin, int x_end, int min_disparity, int num_disparities,
+                        uint16_t *col_cost) {
+  for (int x = MAX(x_begin, min_disparity); x < x_end; x++) {
+    uint16_t *cost = col_cost + (size_t)(x - x_begin) * num_disparities;
+    int k_end = MIN(num_disparities, x - min_disparity + 1);
+    const uint8_t *ra = right_add + x - min_disparity;
+    int la = left_add[x];
+
+    if (left_sub) {
+      const uint8_t *rs = right_sub + x - min_disparity;
+      int ls = left_sub[x];
+      for (int k = 0; k < k_end; k++)
+        cost[k] += abs(la - ra[-k]) - abs(ls - rs[-k]);
+    } else {
+      for (int k = 0; k < k_end; k++)
+        cost[k] += abs(la - ra[-k]);
+    }
+  }
+}
+
+StereoBMCensusSlideFunc stereobm_select_census_func(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("popcnt"))
+    return stereobm_census_slide_popcnt;
+#endif
+  return stereobm_census_slide_scalar;
+}
+
+// Горизонтальное окно: cost[x * nd + d] - сумма col_cost по столбцам
+// [x - half_block, x + half_block] для x из [half_block, width - half_block)
+void stereobm_census_box_row(const uint16_t *col_cost, int width, int half_block,
+                             int num_disparities, uint16_t *window, uint16_t *cost) {
+  if (width < 2 * half_block + 1)
+    return;
+
+  memset(window, 0, num_disparities * sizeof(uint16_t));
+  for (int x = 0; x < 2 * half_block; x++) {
+    const uint16_t *col = col_cost + (size_t)x * num_disparities;
+    for (int d = 0; d < num_disparities; d++)
+      window[d] += col[d];
+  }
+
+  for (int x = half_block; x < width - half_block; x++) {
+    const uint16_t *add = col_cost + (size_t)(x + half_block) * num_disparities;
+    uint16_t *out = cost + (size_t)x * num_disparities;
+    for (int d = 0; d < num_disparities; d++) {
+      window[d] += add[d];
+      out[d] = window[d];
+    }
+
+    const uint16_t *sub = col_cost + (size_t)(x - half_block) * num_disparities;
+    for (int d = 0; d < num_disparities; d++)
+      window[d] -= sub[d];
+  }
+}
+
+// Лучшая и вторая стоимости по [d_begin, d_end) в порядке возрастания d
+// (так же, как в ядрах SAD)
+void stereobm_cost_select(const uint16_t *cost, int d_begin, int d_end,
+                          StereoBMMatch *match) {
+  for (int d = d_begin; d < d_end; d++) {
+    int c = cost[d];
+    if (c < match->best_cost) {
+      match->second_best_cost = match->best_cost;
+      match->best_cost = c;
+      match->best_disparity = d;
+    } else if (c < match->second_best_cost) {
+      match->second_best_cost = c;
+    }
+  }
+}
+
+// Правый вид по тому же объему: стоимость пары (x, d) - это и стоимость
+// правого пикселя x - d при диспаратности d, поэтому минимумы правого вида
+// собираются вдоль диагоналей одним проходом по строке объема. Диапазоны d
+// те же, что при поиске левого вида; при равных стоимостях - меньшая d.
+// Правый вид во время прохода хранится в обратном порядке (r = width - 1 - x + d),
+// тогда диагональ пикселя x - непрерывный отрезок, и он обновляется по 8 d
+// за шаг. right_cost - рабочий буфер: стоимости со сдвигом на 0x8000, чтобы
+// сравнивать их знаковыми командами SSE2.
+void stereobm_right_disparity_row(const uint16_t *cost, int width, int half_block,
+                                  int min_disparity, int num_disparities,
+                                  uint16_t *right_cost, int16_t *right_disparity) {
+  int16_t *rc = (int16_t *)right_cost;
+  int16_t *rd = right_disparity;
+
+  for (int r = 0; r < width; r++) {
+    rc[r] = INT16_MAX;
+    rd[r] = -1;
+  }
+
+  for (int x = half_block; x < width - half_block; x++) {
+    const uint16_t *c = cost + (size_t)x * num_disparities - min_disparity;
+    int16_t *rc_x = rc + width - 1 - x;
+    int16_t *rd_x = rd + width - 1 - x;
+    int d = MAX(min_disparity, x - (width - half_block - 2));
+    int d_end = MIN(min_disparity + num_disparities, x - half_block + 1);
+
+#ifdef STEREOBM_HAVE_X86
+    const __m128i bias = _mm_set1_epi16((short)0x8000);
+    const __m128i step = _mm_set1_epi16(8);
+    __m128i dv = _mm_add_epi16(_mm_set1_epi16((short)d), _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7));
+    for (; d + 8 <= d_end; d += 8) {
+      __m128i cv = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(c + d)), bias);
+      __m128i rv = _mm_loadu_si128((const __m128i *)(rc_x + d));
+      __m128i better = _mm_cmplt_epi16(cv, rv);
+      __m128i old = _mm_loadu_si128((const __m128i *)(rd_x + d));
+      _mm_storeu_si128((__m128i *)(rc_x + d), _mm_min_epi16(cv, rv));
+      _mm_storeu_si128((__m128i *)(rd_x + d),
+                       _mm_or_si128(_mm_and_si128(better, dv), _mm_andnot_si128(better, old)));
+      dv = _mm_add_epi16(dv, step);
+    }
+#endif
+    for (; d < d_end; d++) {
+      int16_t cd = (int16_t)(c[d] ^ 0x8000);
+      if (cd < rc_x[d]) {
+        rc_x[d] = cd;
+        rd_x[d] = (int16_t)d;
+      }
+    }
+  }
+
+  // Обратно в порядок столбцов
+  for (int r = 0, l = width - 1; r < l; r++, l--) {
+    int16_t t = rd[r];
+    rd[r] = rd[l];
+    rd[l] = t;
+  }
+}
@@ -0,0 +1,222 @@
+#include "stereobm_core.h"
+#include "stereobm_io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Консольная утилита: вычисление карты диспаратности без GIMP
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [options] STEREO OUTPUT\n"
+          "       %s [options] LEFT RIGHT OUTPUT\n"
+          "\n"
+          "STEREO is a side-by-side pair, LEFT/RIGHT are separate views\n"
+          "(PNG or binary PGM/PPM). OUTPUT is a 16-bit PGM with disparity*16\n"
+          "or, with the .pfm extension, a float PFM with disparity in pixels\n"
+          "(+inf where no disparity was found; 0 in the PGM).\n"
+          "\n"
+          "Options:\n"
+          "  -n N   num disparities (16..256, multiple of 16), default 64\n"
+          "  -d N   min disparity (0..256 - num disparities), default 0\n"
+          "  -a     narrow the range to the disparities found by a sparse search\n"
+          "  -b N   block size (odd, 3..21), default 15\n"
+          "  -c N   pre filter cap (1..63), default 31\n"
+          "  -t N   texture threshold (0..1000), default 10\n"
+          "  -u N   uniqueness ratio (0..100), default 15\n"
+          "  -l N   left-right check: max disparity difference (-1 = off, 0..256), default -1\n"
+          "  -j N   threads (0 = number of processors), default 0\n"
+          "  -L N   L2 size in KiB for column tiles (0 = detect, -1 = no tiles), default 0\n"
+          "  -p N   pyramid levels (0 = full search, 1..2), default 0\n"
+          "  -k N   search radius around the coarse disparity (1..64), default 3\n"
+          "  -m M   matching cost: sad, census5 (5x5) or census7 (7x9), default sad\n"
+          "  -s N   semi-global matching paths (0 = block matching, 4 or 8), default 0\n"
+          "  -1 N   SGM penalty P1 per window pixel (1..64), default 8\n"
+          "  -2 N   SGM penalty P2 per window pixel (P1..256), default 32\n"
+          "  -q     do not print progress\n"
+          "  -T     print stage timings and counters as JSON to stdout\n",
+          prog, prog);
+}
+
+static void cli_progress(double fraction, void *user_data) {
+  fprintf(stderr, "\rComputing disparity map... %3d%%", (int)(fraction * 100));
+  if (fraction >= 1.0)
+    fputc('\n', stderr);
+}
+
+// Время стадий и счетчики одной строкой JSON
+static void print_stats_json(const StereoBMStats *stats, const StereoBMParams *params,
+                             int width, int height) {
+  double total = 0.0;
+
+  printf("{\"width\": %d, \"height\": %d, \"min_disparity\": %d, \"num_disparities\": %d, "
+         "\"seconds\": {", width, height, params->min_disparity, params->num_disparities);
+  for (int i = 0; i < STEREOBM_NUM_STAGES; i++) {
+    printf("%s\"%s\": %.6f", i ? ", " : "", stereobm_stage_name(i), stats->seconds[i]);
+    // Текстура - часть сопоставления (и сумма по потокам)
+    if (i != STEREOBM_STAGE_TEXTURE)
+      total += stats->seconds[i];
+  }
+  printf(", \"total\": %.6f}, \"pixels\": %lld, \"texture_skipped\": %lld, "
+         "\"candidates\": %lld, \"lr_rejected\": %lld}\n",
+         total, stats->pixels, stats->texture_skipped, stats->candidates, stats->lr_rejected);
+}
+
+// Проверка параметров по диапазонам диалога плагина
+static int params_valid(const StereoBMParams *params) {
+  return params->num_disparities >= 16 && params->num_disparities <= 256 &&
+         params->num_disparities % 16 == 0 &&
+         params->min_disparity >= 0 && params->min_disparity + params->num_disparities <= 256 &&
+         params->block_size >= 3 && params->block_size <= 21 && params->block_size % 2 == 1 &&
+         params->pre_filter_cap >= 1 && params->pre_filter_cap <= 63 &&
+         params->texture_threshold >= 0 && params->texture_threshold <= 1000 &&
+         params->uniqueness_ratio >= 0 && params->uniqueness_ratio <= 100 &&
+         params->disp12_max_diff >= -1 && params->disp12_max_diff <= 256 &&
+         params->num_threads >= 0 && params->cache_bytes >= -1 &&
+         params->pyramid_levels >= 0 && params->pyramid_levels <= 2 &&
+         params->pyramid_radius >= 1 && params->pyramid_radius <= 64 &&
+         (params->sgm_paths == 0 || params->sgm_paths == 4 || params->sgm_paths == 8) &&
+         params->sgm_p1 >= 1 && params->sgm_p1 <= 64 &&
+         params->sgm_p2 >= params->sgm_p1 && params->sgm_p2 <= 256;
+}
+
+int main(int argc, char **argv) {
+  StereoBMParams params;
+  StereoBMStats stats = { { 0 } };
+  int quiet = 0, timings = 0;
+  int opt;
+
+  stereobm_params_init(&params);
+
+  while ((opt = getopt(argc, argv, "n:d:ab:c:t:u:l:j:L:p:k:m:s:1:2:qTh")) != -1) {
+    switch (opt) {
+      case 'n': params.num_disparities = atoi(optarg); break;
+      case 'd': params.min_disparity = atoi(optarg); break;
+      case 'a': params.auto_range = 1; break;
+      case 'b': params.block_size = atoi(optarg); break;
+      case 'c': params.pre_filter_cap = atoi(optarg); break;
+      case 't': params.texture_threshold = atoi(optarg); break;
+      case 'u': params.uniqueness_ratio = atoi(optarg); break;
+      case 'l': params.disp12_max_diff = atoi(optarg); break;
+      case 'j': params.num_threads = atoi(optarg); break;
+      case 'L': params.cache_bytes = atoi(optarg) > 0 ? atoi(optarg) * 1024 : atoi(optarg); break;
+      case 'p': params.pyramid_levels = atoi(optarg); break;
+      case 'k': params.pyramid_radius = atoi(optarg); break;
+      case 'm':
+        if (stereobm_parse_cost(optarg, &params.cost_type)) {
+          fprintf(stderr, "%s: unknown matching cost '%s'\n", argv[0], optarg);
+          return 2;
+        }
+        break;
+      case 's': params.sgm_paths = atoi(optarg); break;
+      case '1': params.sgm_p1 = atoi(optarg); break;
+      case '2': params.sgm_p2 = atoi(optarg); break;
+      case 'q': quiet = 1; break;
+      case 'T': timings = 1; break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  int nargs = argc - optind;
+  if (nargs != 2 && nargs != 3) {
+    usage(argv[0]);
+    return 2;
+  }
+  if (!params_valid(&params)) {
+    fprintf(stderr, "%s: parameter out of range\n", argv[0]);
+    return 2;
+  }
+
+  const char *output_path = argv[argc - 1];
+  StereoBMImage first, second;
+  uint8_t *left_filtered, *right_filtered;
+  int width, height, filtered;
+  double stage_start = stereobm_time_now();
+
+  if (stereobm_image_load(argv[optind], &first))
+    return 1;
+
+  // Разделение, градации серого и фильтр Собеля - один проход по изображению
+  if (nargs == 2) {
+    // side-by-side
+    if (first.width % 2 != 0) {
+      fprintf(stderr, "%s: side-by-side image must have even width\n", argv[optind]);
+      stereobm_image_free(&first);
+      return 1;
+    }
+    stereobm_stats_stage(&stats, STEREOBM_STAGE_READ, &stage_start);
+    width = first.width / 2;
+    height = first.height;
+    left_filtered = malloc((size_t)width * height);
+    right_filtered = malloc((size_t)width * height);
+    filtered = left_filtered && right_filtered &&
+               stereobm_prefilter_sbs(first.data, first.width, first.height, first.channels,
+                                      params.pre_filter_cap, left_filtered, right_filtered) == 0;
+  } else {
+    if (stereobm_image_load(argv[optind + 1], &second)) {
+      stereobm_image_free(&first);
+      return 1;
+    }
+    stereobm_stats_stage(&stats, STEREOBM_STAGE_READ, &stage_start);
+    if (first.width != second.width || first.height != second.height) {
+      fprintf(stderr, "%s: left and right images differ in size\n", argv[0]);
+      stereobm_image_free(&first);
+      stereobm_image_free(&second);
+      return 1;
+    }
+    width = first.width;
+    height = first.height;
+    left_filtered = malloc((size_t)width * height);
+    right_filtered = malloc((size_t)width * height);
+    filtered = left_filtered && right_filtered &&
+               stereobm_prefilter_view(first.data, (size_t)width * first.channels, width, height,
+                                       first.channels, params.pre_filter_cap, left_filtered) == 0 &&
+               stereobm_prefilter_view(second.data, (size_t)width * second.channels, width,
+                                       height, second.channels, params.pre_filter_cap,
+                                       right_filtered) == 0;
+    stereobm_image_free(&second);
+  }
+  stereobm_image_free(&first);
+  if (!filtered) {
+    fprintf(stderr, "%s: out of memory\n", argv[0]);
+    free(left_filtered);
+    free(right_filtered);
+    return 1;
+  }
+  stereobm_stats_stage(&stats, STEREOBM_STAGE_PREFILTER, &stage_start);
+
+  // Автоматический диапазон оценивается здесь, чтобы его можно было показать
+  if (params.auto_range) {
+    StereoBMParams estimated;
+    stereobm_estimate_range(left_filtered, right_filtered, width, height, 0, 0, height,
+                            &params, &estimated);
+    if (!quiet)
+      fprintf(stderr, "Disparity range: %d..%d\n", estimated.min_disparity,
+              estimated.min_disparity + estimated.num_disparities - 1);
+    params = estimated;
+    stereobm_stats_stage(&stats, STEREOBM_STAGE_RANGE, &stage_start);
+  }
+
+  int16_t *disparity_map = stereobm_compute_filtered(left_filtered, right_filtered, width, height,
+                                                     &params, &stats,
+                                                     quiet ? NULL : cli_progress, NULL);
+  free(left_filtered);
+  free(right_filtered);
+  if (!disparity_map) {
+    fprintf(stderr, "%s: out of memory\n", argv[0]);
+    return 1;
+  }
+
+  stage_start = stereobm_time_now();
+  int result = stereobm_write_disparity(output_path, disparity_map, width, height);
+  stereobm_stats_stage(&stats, STEREOBM_STAGE_WRITE, &stage_start);
+  if (timings)
+    print_stats_json(&stats, &params, width, height);
+
+  free(disparity_map);
+
+  return result ? 1 : 0;
+}
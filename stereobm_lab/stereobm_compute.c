@@ -1,218 +1,1483 @@
-#include "stereobm.h"
+#include "stereobm_core.h"
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 // Макрос для ограничения значения в диапазоне [low, high]
 #define CLAMP(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
 
-// Предварительная фильтрация X-Sobel
-void prefilter_xsobel(const guchar *input, guchar *output, 
-                     gint width, gint height, gint pre_filter_cap) {
-    
-    const gint OFS = 256*4, TABSZ = OFS*2 + 256;
-    guchar tab[TABSZ];
-
-    // Создание таблицы поиска для быстрого ограничения значений
-    for(gint x = 0; x < TABSZ; x++)
-        tab[x] = (guchar)(x - OFS < -pre_filter_cap ? 0 : x - OFS > pre_filter_cap ? pre_filter_cap*2 : x - OFS + pre_filter_cap);
-    
-    guchar border_value = tab[0 + OFS]; // val0 
-
-    // фильтр Собеля 
-    for(gint i = 1; i < height - 1; i++) {
-        for(gint j = 1; j < width - 1; j++) {
-            gint d0 = input[(i-1)*width + j+1] - input[(i-1)*width + j-1];
-            gint d1 = input[i*width + j+1] - input[i*width + j-1];
-            gint d2 = input[(i+1)*width + j+1] - input[(i+1)*width + j-1];
-            
-            gint val = d0 + d1*2 + d2;
-            output[i*width + j] = tab[val + OFS];
-        }
+// Параметры по умолчанию
+void stereobm_params_init(StereoBMParams *params) {
+  params->num_disparities = 64;
+  params->min_disparity = 0;
+  params->auto_range = 0;
+  params->block_size = 15;
+  params->pre_filter_cap = 31;
+  params->texture_threshold = 10;
+  params->uniqueness_ratio = 15;
+  params->num_threads = 0;
+  params->cache_bytes = 0;
+  params->pyramid_levels = 0;
+  params->pyramid_radius = 3;
+  params->cost_type = STEREOBM_COST_SAD;
+  params->sgm_paths = 0;
+  params->sgm_p1 = 8;
+  params->sgm_p2 = 32;
+  params->disp12_max_diff = -1;
+}
+
+static const char *const cost_names[] = { "sad", "census5", "census7" };
+
+const char *stereobm_cost_name(StereoBMCostType cost_type) {
+  return cost_names[CLAMP((int)cost_type, 0, STEREOBM_COST_CENSUS_7X9)];
+}
+
+int stereobm_parse_cost(const char *name, StereoBMCostType *cost_type) {
+  for (int i = 0; i <= STEREOBM_COST_CENSUS_7X9; i++) {
+    if (!strcmp(name, cost_names[i])) {
+      *cost_type = (StereoBMCostType)i;
+      return 0;
     }
+  }
+  return -1;
+}
+
+static const char *const stage_names[STEREOBM_NUM_STAGES] = {
+  "read", "prefilter", "range", "pyramid", "matching", "texture", "colorize", "write"
+};
+
+const char *stereobm_stage_name(StereoBMStage stage) {
+  return stage_names[CLAMP((int)stage, 0, STEREOBM_NUM_STAGES - 1)];
+}
+
+double stereobm_time_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void stereobm_stats_stage(StereoBMStats *stats, StereoBMStage stage, double *since) {
+  double now = stereobm_time_now();
+
+  if (stats)
+    stats->seconds[stage] += now - *since;
+  *since = now;
+}
+
+// Строка в градациях серого: BT.601 в фиксированной точке (как в OpenCV),
+// (4899*R + 9617*G + 1868*B + 2^13) >> 14
+static void gray_row(const uint8_t *src, int width, uint8_t *dst) {
+    for(int x = 0; x < width; x++, src += 3)
+        dst[x] = (uint8_t)((src[0] * 4899 + src[1] * 9617 + src[2] * 1868 + (1 << 13)) >> 14);
+}
+
+// Строка y вида в градациях серого; для RGB пересчитывается в одну из трех
+// строк кольцевого буфера, серое изображение читается напрямую
+static const uint8_t *view_gray_row(const uint8_t *image, size_t stride, int width,
+                                    int channels, int y, uint8_t *ring) {
+    const uint8_t *src = image + (size_t)y * stride;
+    if(channels < 3)
+        return src;
 
-    // Обработка границ
-    for(gint i = 0; i < height; i++) {
-        output[i*width] = border_value;
-        output[i*width + width - 1] = border_value;
+    uint8_t *dst = ring + (size_t)(y % 3) * width;
+    gray_row(src, width, dst);
+    return dst;
+}
+
+// Совмещенный проход для строк [y_begin, y_end) вида высотой height.
+// image указывает на строку row_offset; в нем должны быть строки
+// [y_begin - 1, y_end + 1) в пределах изображения. Выходная строка y
+// пишется в output + (y - y_begin) * width.
+int stereobm_prefilter_view_rows(const uint8_t *image, size_t stride, int width, int height,
+                                  int channels, int pre_filter_cap, int row_offset,
+                                  int y_begin, int y_end, uint8_t *output) {
+    uint8_t border_value = (uint8_t)pre_filter_cap; // val0
+    uint8_t *ring = channels >= 3 ? malloc((size_t)width * 3) : NULL;
+
+    if(channels >= 3 && !ring)
+        return -1;
+
+    // Верхняя и нижняя строки изображения - граничное значение
+    if(y_begin == 0 && y_end > 0)
+        memset(output, border_value, width);
+    if(height > 1 && y_begin <= height - 1 && y_end >= height)
+        memset(output + (size_t)(height - 1 - y_begin) * width, border_value, width);
+
+    // фильтр Собеля по трем строкам
+    int first = MAX(y_begin, 1), last = MIN(y_end, height - 1);
+    if(first < last) {
+        const uint8_t *r0 = view_gray_row(image, stride, width, channels, first - 1 - row_offset, ring);
+        const uint8_t *r1 = view_gray_row(image, stride, width, channels, first - row_offset, ring);
+        for(int i = first; i < last; i++) {
+            const uint8_t *r2 = view_gray_row(image, stride, width, channels, i + 1 - row_offset, ring);
+            stereobm_xsobel_row(r0, r1, r2, width, pre_filter_cap, output + (size_t)(i - y_begin) * width);
+            r0 = r1;
+            r1 = r2;
+        }
     }
-    for(gint j = 0; j < width; j++) {
-        output[j] = border_value;
-        output[(height-1)*width + j] = border_value;
+
+    free(ring);
+    return 0;
+}
+
+// Совмещенный проход: выделение вида (channels = 1 или 3), перевод в
+// градации серого и X-Sobel. Промежуточное серое изображение не хранится.
+int stereobm_prefilter_view(const uint8_t *image, size_t stride, int width, int height,
+                            int channels, int pre_filter_cap, uint8_t *output) {
+    return stereobm_prefilter_view_rows(image, stride, width, height, channels, pre_filter_cap,
+                                        0, 0, height, output);
+}
+
+// Предварительная фильтрация X-Sobel изображения в градациях серого
+void prefilter_xsobel(const uint8_t *input, uint8_t *output,
+                     int width, int height, int pre_filter_cap) {
+    stereobm_prefilter_view(input, width, width, height, 1, pre_filter_cap, output);
+}
+
+// Фильтрация обеих половин side-by-side изображения (width - полная ширина)
+int stereobm_prefilter_sbs(const uint8_t *image, int width, int height, int channels,
+                           int pre_filter_cap, uint8_t *left_filtered, uint8_t *right_filtered) {
+    int stereo_width = width / 2;
+    size_t stride = (size_t)width * channels;
+
+    if(stereobm_prefilter_view(image, stride, stereo_width, height, channels,
+                               pre_filter_cap, left_filtered))
+        return -1;
+    return stereobm_prefilter_view(image + (size_t)stereo_width * channels, stride, stereo_width,
+                                   height, channels, pre_filter_cap, right_filtered);
+}
+
+// Суммы текстуры по столбцам окна строк [y - half_block, y + half_block]
+static void texture_columns_init(const uint8_t *img, int width, int y, int half_block,
+                                 const uint8_t *tab, int *col_sum) {
+    memset(col_sum, 0, width * sizeof(int));
+    for(int i = y - half_block; i <= y + half_block; i++) {
+        const uint8_t *row = img + i * width;
+        for(int x = 0; x < width; x++)
+            col_sum[x] += tab[row[x]];
     }
 }
 
-// Вычисление текстуры в окрестности точки
-gint compute_texture(const guchar* img, gint x, gint y, gint width, gint height, gint block_size, const guchar* tab) {
-    gint texture = 0;
-    gint half_block = block_size / 2;
+// Сдвиг окна столбцов на одну строку вниз (к строке y)
+static void texture_columns_slide(const uint8_t *img, int width, int y, int half_block,
+                                  const uint8_t *tab, int *col_sum) {
+    const uint8_t *add = img + (y + half_block) * width;
+    const uint8_t *sub = img + (y - half_block - 1) * width;
+    for(int x = 0; x < width; x++)
+        col_sum[x] += tab[add[x]] - tab[sub[x]];
+}
+
+// Маска строки: 1 - текстура окна не ниже порога, пиксель участвует в поиске.
+// Текстура вне рабочей области считается нулевой, как и раньше. Если sums
+// не NULL, туда же пишутся суммы текстуры окна (для кэша предпросмотра).
+static void texture_row_mask(const int *col_sum, int width, int half_block,
+                             int texture_threshold, int row_valid, uint8_t *mask,
+                             int32_t *sums) {
+    uint8_t border = 0 >= texture_threshold;
 
-    if(x < half_block || x >= width - half_block - 1 ||
-       y < half_block || y >= height - half_block - 1) {
-        return 0;
+    if(sums)
+        memset(sums, 0, width * sizeof(int32_t));
+    if(!row_valid) {
+        memset(mask, border, width);
+        return;
     }
-    
-    // Суммирование значений текстуры в окне
-    for(gint i = -half_block; i <= half_block; i++) {
-        for(gint j = -half_block; j <= half_block; j++) {
-            gint nx = x + j;
-            gint ny = y + i;
-            gint lval = img[ny * width + nx];
-            texture += tab[lval]; 
-        }
+
+    int x_end = width - half_block - 1;
+    for(int x = 0; x < MIN(half_block, width); x++)
+        mask[x] = border;
+    for(int x = MAX(x_end, half_block); x < width; x++)
+        mask[x] = border;
+    if(x_end <= half_block)
+        return;
+
+    // Скользящая сумма по горизонтали
+    int texture = 0;
+    for(int x = 0; x < 2 * half_block; x++)
+        texture += col_sum[x];
+    for(int x = half_block; x < x_end; x++) {
+        texture += col_sum[x + half_block];
+        mask[x] = texture >= texture_threshold;
+        if(sums)
+            sums[x] = texture;
+        texture -= col_sum[x - half_block];
     }
-    return texture;
 }
 
-// Основная функция вычисления карты диспаратности
-gint* stereobm_compute(const guchar *left_img, const guchar *right_img,
-                             gint width, gint height, StereoBMParams *params) {
-  gint i, j, d;
-  gint half_block = params->block_size / 2;
-  gint min_disparity = 0;
+// Маска текстуры строки y; col_sum и columns_ready - состояние скользящих сумм
+// между последовательными строками. img начинается со строки row_offset.
+static void texture_row(const uint8_t *img, int width, int height, int row_offset, int y,
+                        int half_block, const uint8_t *tab, int texture_threshold,
+                        int *col_sum, int *columns_ready, uint8_t *mask, int32_t *sums) {
+    int row_valid = y >= half_block && y < height - half_block - 1;
+    if(row_valid) {
+        if(*columns_ready)
+            texture_columns_slide(img, width, y - row_offset, half_block, tab, col_sum);
+        else
+            texture_columns_init(img, width, y - row_offset, half_block, tab, col_sum);
+    }
+    *columns_ready = row_valid;
+    texture_row_mask(col_sum, width, half_block, texture_threshold, row_valid, mask, sums);
+}
 
-  // Выделение памяти для отфильтрованных изображений
-  guchar *left_filtered = g_new0(guchar, width * height);
-  guchar *right_filtered = g_new0(guchar, width * height);
+static void texture_tab_init(uint8_t *tab, int pre_filter_cap) {
+    for(int x = 0; x < 256; x++)
+        tab[x] = (uint8_t)abs(x - pre_filter_cap);
+}
 
-  // Предварительная фильтрация обоих изображений
-  prefilter_xsobel(left_img, left_filtered, width, height, params->pre_filter_cap);
-  prefilter_xsobel(right_img, right_filtered, width, height, params->pre_filter_cap);
+// Маска текстуры для всего изображения (то же, что считается при поиске)
+int stereobm_texture_mask(const uint8_t *left_filtered, int width, int height,
+                          const StereoBMParams *params, uint8_t *mask) {
+    uint8_t tab[256];
+    int *col_sum = malloc(width * sizeof(int));
+    int columns_ready = 0;
 
-  gint *disparity_map = g_new0(gint, width * height);
+    if(!col_sum)
+        return -1;
 
-  // Таблица для вычисления текстуры
-  const gint TABSZ = 256;
-  guchar tab[TABSZ];
-  for(gint x = 0; x < TABSZ; x++)
-    tab[x] = (guchar)abs(x - params->pre_filter_cap);
-  
-  // Основной цикл по всем пикселям изображения
-  for (i = 0; i < height; i++) {
-    for (j = 0; j < width; j++) {
-      // Вычисление текстуры в текущей точке
-      gint texture = compute_texture(left_filtered, j, i, width, height, params->block_size, tab);
-
-      // Отсечение слаботекстурированных областей
-      if (texture < params->texture_threshold) {
-        disparity_map[i * width + j] = 0;
-        continue;
+    texture_tab_init(tab, params->pre_filter_cap);
+    for(int i = 0; i < height; i++)
+        texture_row(left_filtered, width, height, 0, i, params->block_size / 2, tab,
+                    params->texture_threshold, col_sum, &columns_ready, mask + (size_t)i * width,
+                    NULL);
+
+    free(col_sum);
+    return 0;
+}
+
+// Горизонтальная полоса строк [y_begin, y_end). Окна соседних полос
+// перекрываются на half_block строк, которые читаются из общих
+// отфильтрованных изображений только на чтение.
+typedef struct {
+  int y_begin;
+  int y_end;
+} StereoBMStripe;
+
+// Карта, задающая диапазон поиска: при shift = 1 - грубый уровень пирамиды
+// (строка r соответствует строкам 2r и 2r + 1 текущего уровня, столбец c -
+// 2c и 2c + 1), при shift = 0 - карта того же масштаба (предыдущий кадр
+// последовательности). В disparity_map лежат только нужные строки карты
+// высотой height, начиная с row_begin.
+typedef struct {
+  const int16_t *disparity_map;
+  int width;
+  int height;
+  int row_begin;
+  int shift;
+  int radius;
+} StereoBMGuide;
+
+// Строк полосы, которые проходятся в плитке столбцов за один раз (маски
+// текстуры этих строк считаются заранее)
+#define STEREOBM_TILE_ROWS 32
+
+// Плитка не уже STEREOBM_TILE_MIN столбцов: иначе поля окна плитки
+// (суммы столбцов объема считаются с перекрытием) съедают выигрыш
+#define STEREOBM_TILE_MIN 64
+
+// Рабочие буферы строк одного потока
+typedef struct {
+  int *col_sum;
+  uint8_t *textured;      // маски STEREOBM_TILE_ROWS строк
+  int tile_width;         // плитки, под которые выделены буферы объема
+  // Объем стоимостей строки (census или SAD с LR-проверкой): суммы столбцов
+  // окна каждой плитки (с полями half_block) и стоимости плитки для каждого (x, d)
+  uint16_t *volume_col;
+  uint16_t *volume_window;
+  uint16_t *volume;
+  // LR-проверка: минимумы правого вида по строке объема
+  uint16_t *right_cost;
+  int16_t *right_disparity;
+} StereoBMRowScratch;
+
+// Объем стоимостей строки нужен census и LR-проверке; SAD без нее ищет
+// ядрами по окну
+static int cost_volume_used(const StereoBMParams *params) {
+  return params->cost_type != STEREOBM_COST_SAD || params->disp12_max_diff >= 0;
+}
+
+// Ширина плитки: рабочий набор строки плитки занимает четверть L2 (остальное -
+// карта, маски, соседний поток на том же ядре). Для ядер SAD это block_size строк обоих видов
+// шириной tile + num_disparities, для объема стоимостей - суммы столбцов и
+// стоимости окна (по num_disparities значений uint16 на столбец) и четыре
+// строки census-дескрипторов. LR-проверке нужна вся строка объема, поэтому
+// с ней плиток нет, как и при неизвестном размере L2.
+int stereobm_tile_width(const StereoBMParams *params, int width) {
+  long cache = params->cache_bytes;
+  int nd = params->num_disparities;
+  long tile;
+
+  if (cache == 0)
+    cache = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (cache <= 0 || params->disp12_max_diff >= 0)
+    return width;
+
+  if (cost_volume_used(params))
+    tile = cache / 4 / (4 * nd + 4 * (long)sizeof(uint64_t));
+  else
+    tile = cache / 4 / (2 * params->block_size) - nd;
+  if (tile >= width)
+    return width;
+
+  // Плитки одинаковой ширины, без узкого остатка
+  tile = MAX(tile, STEREOBM_TILE_MIN);
+  int num_tiles = (int)((width + tile - 1) / tile);
+  return (width + num_tiles - 1) / num_tiles;
+}
+
+// Рабочие буферы раздаются из одного блока (StereoBMArena). Блок не
+// обнуляется: все буферы перезаписываются перед чтением.
+void *stereobm_arena_take(StereoBMArena *arena, size_t size) {
+  void *p = arena->base ? arena->base + arena->size : NULL;
+  arena->size += (size + STEREOBM_ARENA_ALIGN - 1) & ~(size_t)(STEREOBM_ARENA_ALIGN - 1);
+  return p;
+}
+
+void *stereobm_arena_alloc(size_t size) {
+  return aligned_alloc(STEREOBM_ARENA_ALIGN, MAX(size, STEREOBM_ARENA_ALIGN));
+}
+
+static void row_scratch_layout(StereoBMArena *arena, StereoBMRowScratch *scratch, int width,
+                               int num_disparities, const StereoBMParams *params) {
+  int tile_width = stereobm_tile_width(params, width);
+  int num_tiles = (width + tile_width - 1) / tile_width;
+  int half_block = params->block_size / 2;
+
+  scratch->col_sum = stereobm_arena_take(arena, width * sizeof(int));
+  scratch->textured = stereobm_arena_take(arena, (size_t)width * STEREOBM_TILE_ROWS);
+  scratch->tile_width = tile_width;
+  scratch->volume_col = scratch->volume_window = scratch->volume = NULL;
+  scratch->right_cost = NULL;
+  scratch->right_disparity = NULL;
+  if (cost_volume_used(params)) {
+    size_t tile_columns = MIN(tile_width + 2 * half_block, width);
+    scratch->volume_col = stereobm_arena_take(arena,
+                                              (size_t)(width + 2 * half_block * num_tiles) *
+                                              num_disparities * sizeof(uint16_t));
+    scratch->volume_window = stereobm_arena_take(arena, num_disparities * sizeof(uint16_t));
+    scratch->volume = stereobm_arena_take(arena,
+                                          tile_columns * num_disparities * sizeof(uint16_t));
+  }
+  if (params->disp12_max_diff >= 0) {
+    scratch->right_cost = stereobm_arena_take(arena, width * sizeof(uint16_t));
+    scratch->right_disparity = stereobm_arena_take(arena, width * sizeof(int16_t));
+  }
+}
+
+// Буферы, которые переживают вызов compute_band() (последовательность кадров,
+// контекст): рабочие буферы потоков и census-дескрипторы, размещенные в арене
+typedef struct {
+  StereoBMRowScratch *scratch;
+  int num_scratch;
+  uint64_t *census;
+  size_t census_count;    // дескрипторов в census (на оба вида)
+} StereoBMBuffers;
+
+// Раскладка буферов для num_scratch потоков и census_count дескрипторов.
+// Массив scratch тоже лежит в арене; при подсчете размера его еще нет, и
+// буферы потока раскладываются во временную копию.
+static void buffers_layout(StereoBMArena *arena, StereoBMBuffers *buffers, int width,
+                           int num_scratch, size_t census_count, const StereoBMParams *params) {
+  buffers->num_scratch = num_scratch;
+  buffers->census_count = census_count;
+  buffers->scratch = stereobm_arena_take(arena, num_scratch * sizeof(StereoBMRowScratch));
+  for (int t = 0; t < num_scratch; t++) {
+    StereoBMRowScratch scratch;
+    row_scratch_layout(arena, &scratch, width, params->num_disparities, params);
+    if (buffers->scratch)
+      buffers->scratch[t] = scratch;
+  }
+  buffers->census = census_count > 0 ?
+                    stereobm_arena_take(arena, census_count * sizeof(uint64_t)) : NULL;
+}
+
+// Контекст: арена, которая растет до наибольшей раскладки и переживает вызовы
+struct StereoBMContext {
+  void *arena;
+  size_t capacity;
+  StereoBMBuffers buffers;
+  // Отфильтрованные виды и карта stereobm_context_compute()
+  uint8_t *left_filtered;
+  uint8_t *right_filtered;
+  int16_t *disparity_map;
+  // Буферы SGM: их размер известен только после оценки auto_range по
+  // отфильтрованным видам, поэтому это второй блок, который тоже только растет
+  void *sgm_work;
+  size_t sgm_capacity;
+};
+
+// Блок *block не меньше size байт (содержимое не сохраняется); 0 - успех
+static int block_reserve(void **block, size_t *capacity, size_t size) {
+  if (size <= *capacity)
+    return 0;
+
+  free(*block);
+  *block = stereobm_arena_alloc(size);
+  *capacity = *block ? size : 0;
+  return *block ? 0 : -1;
+}
+
+// SGM по отфильтрованным видам в disparity_map с буферами в блоке *work
+// (растет при нехватке); -1 - нехватка памяти
+static int sgm_frame(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                     int width, int height, const StereoBMParams *params,
+                     void **work, size_t *capacity, int16_t *disparity_map,
+                     StereoBMStats *stats, StereoBMProgressFunc progress, void *progress_data) {
+  StereoBMParams ranged;
+  double stage_start = stereobm_time_now();
+
+  if (params->auto_range) {
+    stereobm_estimate_range(left_filtered, right_filtered, width, height, 0, 0, height,
+                            params, &ranged);
+    params = &ranged;
+    stereobm_stats_stage(stats, STEREOBM_STAGE_RANGE, &stage_start);
+  }
+  if (block_reserve(work, capacity, stereobm_sgm_work_size(width, height, params)))
+    return -1;
+
+  stereobm_compute_sgm_work(left_filtered, right_filtered, width, height, params, *work,
+                            disparity_map, stats, progress, progress_data);
+  return 0;
+}
+
+// Необязательные части вычисления полосы (NULL - нет)
+typedef struct {
+  // Кэш предпросмотра: сохраняются результаты сопоставления всех пикселей
+  // без проверок (строки с row_offset = 0), disparity_map не заполняется
+  StereoBMMatchCache *cache;
+  const atomic_int *cancel;     // отмена между строками
+  const StereoBMGuide *prior;   // диапазоны по предыдущему кадру (вместо пирамиды)
+  StereoBMBuffers *buffers;
+  int *min_disp;                // диапазон найденных диспаратностей (обновляется)
+  int *max_disp;
+  StereoBMStats *stats;         // время стадий и счетчики (прибавляются)
+} StereoBMBandOptions;
+
+// Итоги строк одного потока: диапазон найденных диспаратностей (как в
+// stereobm_disparity_minmax) и счетчики для StereoBMStats
+typedef struct {
+  int min_disp;
+  int max_disp;
+  long long texture_skipped;
+  long long candidates;
+  long long lr_rejected;
+  double texture_seconds;
+} StereoBMRowTotals;
+
+// Общее состояние параллельного вычисления. Отфильтрованные изображения
+// начинаются со строки row_offset, карта - со строки out_offset.
+typedef struct {
+  const uint8_t *left_filtered;
+  const uint8_t *right_filtered;
+  int16_t *disparity_map;
+  int width;
+  int height;
+  int row_offset;
+  int out_offset;
+  const StereoBMParams *params;
+  StereoBMMatchFunc match_func;
+  int match_chunk;        // диспаратностей за шаг ядра (1 - скалярное)
+  const StereoBMGuide *guide;  // NULL - полный поиск
+  // Census-дескрипторы строк начиная с census_offset (NULL - SAD)
+  const uint64_t *census_left;
+  const uint64_t *census_right;
+  int census_offset;
+  StereoBMCensusSlideFunc census_slide;
+  int cost_volume;        // поиск по объему стоимостей строки (census, LR)
+  int tile_width;         // ширина плитки столбцов (см. stereobm_compute_rows)
+  uint8_t tab[256];       // |x - pre_filter_cap| для текстуры
+  StereoBMMatchCache *cache;   // см. StereoBMBandOptions
+  const atomic_int *cancel;
+  StereoBMRowScratch *scratch; // по одному на поток
+  atomic_int next_worker;      // индекс буферов следующего потока
+
+  StereoBMStripe *stripes;
+  int num_stripes;
+  atomic_int next_stripe;  // следующая свободная полоса
+  atomic_int rows_done;    // готовые строки (для прогресса)
+
+  int threads_left;        // защищен mutex
+  StereoBMRowTotals totals;  // итоги всех потоков, защищены mutex
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} StereoBMJob;
+
+// Сужение диапазона до [2 * min - radius, 2 * max + radius] (для карты того же
+// масштаба - [min - radius, max + radius]) по найденным диспаратностям
+// окрестности 3x3 (на границах объектов в нее попадают обе поверхности). Диапазон дополняется до целого числа шагов SIMD-ядра:
+// лишние кандидаты ничего не стоят. Если грубых диспаратностей нет или они
+// не попадают в допустимый диапазон, остается полный поиск.
+static void guide_range(const StereoBMGuide *guide, int y, int x, int chunk,
+                        int *d_begin, int *d_end) {
+  int gy = MIN(y >> guide->shift, guide->height - 1);
+  int gx = MIN(x >> guide->shift, guide->width - 1);
+  int coarse_min = INT_MAX, coarse_max = 0;
+
+  for (int cy = MAX(gy - 1, 0); cy <= MIN(gy + 1, guide->height - 1); cy++) {
+    const int16_t *row = guide->disparity_map + (size_t)(cy - guide->row_begin) * guide->width;
+    for (int cx = MAX(gx - 1, 0); cx <= MIN(gx + 1, guide->width - 1); cx++) {
+      if (row[cx] > 0) {
+        coarse_min = MIN(coarse_min, row[cx]);
+        coarse_max = MAX(coarse_max, row[cx]);
       }
-      
-      // Поиск наилучшей диспаратности
-      gint best_disparity = 0;
-      gint best_cost = G_MAXINT;
-      gint second_best_cost = G_MAXINT;
-
-      // Перебор всех возможных диспаратностей
-      for (d = 0; d < params->num_disparities; d++) {
-        gint right_x = j - d;
-
-        // границы для правого изображения
-        if (right_x < half_block || right_x >= width - half_block - 1) {
-          continue;
-        }
+    }
+  }
+  if (coarse_max == 0)
+    return;
 
-        gint sad = 0;
-        
-        // SAD для текущей диспаратности
-        for (gint bi = -half_block; bi <= half_block; bi++) {
-          for (gint bj = -half_block; bj <= half_block; bj++) {
-            gint left_idx = (i + bi) * width + (j + bj);
-            gint right_idx = (i + bi) * width + (right_x + bj);
-            
-            sad += abs(left_filtered[left_idx] - right_filtered[right_idx]);
-          }
-        }
+  int lo = MAX(*d_begin, (coarse_min << guide->shift) / STEREOBM_DISP_SCALE - guide->radius);
+  int hi = MIN(*d_end, (coarse_max << guide->shift) / STEREOBM_DISP_SCALE + guide->radius + 1);
+  if (lo >= hi)
+    return;
+
+  int span = (hi - lo + chunk - 1) / chunk * chunk;
+  lo = MAX(*d_begin, MIN(lo - (span - (hi - lo)) / 2, *d_end - span));
+  *d_begin = lo;
+  *d_end = MIN(*d_end, lo + span);
+}
+
+// Сдвиг сумм столбцов [x_begin, x_end) объема: добавление строки add и
+// вычитание sub (< 0 - нет); строки - census-дескрипторы или (SAD)
+// отфильтрованные изображения
+static void volume_slide(const StereoBMJob *job, int add, int sub, int x_begin, int x_end,
+                         uint16_t *col_cost) {
+  int width = job->width;
+  int min_disparity = job->params->min_disparity;
+  int num_disparities = job->params->num_disparities;
+
+  if (job->census_left) {
+    size_t a = (size_t)(add - job->census_offset) * width;
+    size_t b = (size_t)(sub - job->census_offset) * width;
+    job->census_slide(job->census_left + a, job->census_right + a,
+                      sub >= 0 ? job->census_left + b : NULL,
+                      sub >= 0 ? job->census_right + b : NULL,
+                      x_begin, x_end, min_disparity, num_disparities, col_cost);
+  } else {
+    size_t a = (size_t)(add - job->row_offset) * width;
+    size_t b = (size_t)(sub - job->row_offset) * width;
+    stereobm_sad_slide(job->left_filtered + a, job->right_filtered + a,
+                       sub >= 0 ? job->left_filtered + b : NULL,
+                       sub >= 0 ? job->right_filtered + b : NULL,
+                       x_begin, x_end, min_disparity, num_disparities, col_cost);
+  }
+}
+
+// Стоимости строки y для столбцов [x_begin, x_end) и всех d (индекс
+// (x - x_begin) * nd + d - min_disparity): вертикальные суммы столбцов
+// сдвигаются на строку (или считаются заново), затем горизонтальное окно.
+// Окно заполнено для x из [x_begin + half_block, x_end - half_block).
+static void cost_volume_row(const StereoBMJob *job, int y, int half_block,
+                            int x_begin, int x_end, uint16_t *col_cost,
+                            int *columns_ready, uint16_t *window, uint16_t *cost) {
+  int num_disparities = job->params->num_disparities;
+
+  if (*columns_ready) {
+    volume_slide(job, y + half_block, y - half_block - 1, x_begin, x_end, col_cost);
+  } else {
+    memset(col_cost, 0, (size_t)(x_end - x_begin) * num_disparities * sizeof(uint16_t));
+    for (int r = y - half_block; r <= y + half_block; r++)
+      volume_slide(job, r, -1, x_begin, x_end, col_cost);
+  }
+  *columns_ready = 1;
+
+  stereobm_census_box_row(col_cost, x_end - x_begin, half_block, num_disparities, window, cost);
+}
+
+// Проверка уникальности найденной диспаратности; 0 - отбрасывается
+static inline int16_t match_validate(int best_disparity, int best_cost, int second_best_cost,
+                                     int uniqueness_ratio) {
+  // проверка качества
+  if (best_cost == INT_MAX)
+    return 0;
+
+  int uniqueness_threshold;
+  if (best_cost > 0) {
+      uniqueness_threshold = (best_cost * uniqueness_ratio) / 100;
+  } else {
+      uniqueness_threshold = 0;  
+  }
 
-        if (sad < best_cost) {
-          second_best_cost = best_cost;
-          best_cost = sad;
-          best_disparity = d;
-        } else if (sad < second_best_cost) {
-          second_best_cost = sad;
+  // Проверка с минимальным порогом 
+  if (second_best_cost == INT_MAX || second_best_cost - best_cost > uniqueness_threshold)
+    return (int16_t)(best_disparity * STEREOBM_DISP_SCALE);
+  return 0;
+}
+
+// LR-проверка: диспаратность правого вида в точке x - d_left должна
+// отличаться от d_left не больше чем на max_diff (-1 - правый пиксель без пары)
+static inline int lr_consistent(int right_disparity, int d_left, int max_diff) {
+  return right_disparity >= 0 && abs(d_left - right_disparity) <= max_diff;
+}
+
+// Поиск по [d_begin, d_end), начиная с диспаратности соседнего пикселя
+// (hint, -1 - нет). Скалярное ядро бросает кандидата, как только его
+// частичная сумма превысит вторую лучшую стоимость, и низкая вторая
+// стоимость в начале обхода отсекает большую часть окна у остальных;
+// результат тот же, что при обходе по порядку (см. match_merge). SIMD-ядра
+// считают блок диспаратностей целиком, диапазон им передается как есть
+static void match_hinted(const StereoBMJob *job, int x, int y, int half_block,
+                         int d_begin, int d_end, int hint, StereoBMMatch *match) {
+  if (job->match_chunk > 1 || hint < d_begin || hint >= d_end) {
+    job->match_func(job->left_filtered, job->right_filtered, job->width, x, y,
+                    half_block, d_begin, d_end, match);
+    return;
+  }
+
+  job->match_func(job->left_filtered, job->right_filtered, job->width, x, y,
+                  half_block, hint, hint + 1, match);
+  job->match_func(job->left_filtered, job->right_filtered, job->width, x, y,
+                  half_block, d_begin, hint, match);
+  job->match_func(job->left_filtered, job->right_filtered, job->width, x, y,
+                  half_block, hint + 1, d_end, match);
+}
+
+// Поиск в строке i для столбцов плитки [x_begin, x_end). textured - маска
+// строки, volume - стоимости строки со столбца volume_begin (NULL - поиск
+// ядрами SAD), right_disparity - правый вид для LR-проверки (NULL - без нее).
+static void match_row(StereoBMJob *job, int i, int x_begin, int x_end,
+                      const uint8_t *textured, const uint16_t *volume, int volume_begin,
+                      const int16_t *right_disparity, StereoBMRowTotals *totals) {
+  const StereoBMParams *params = job->params;
+  int width = job->width;
+  int half_block = params->block_size / 2;
+  int min_disparity = params->min_disparity;
+  int num_disparities = params->num_disparities;
+  int row_valid = i >= half_block && i < job->height - half_block;
+  StereoBMMatchCache *cache = job->cache;
+  int16_t *disparity_row = cache ? NULL : job->disparity_map + (size_t)(i - job->out_offset) * width;
+  size_t cache_row = (size_t)i * width;
+  int hint = -1;
+
+  for (int j = x_begin; j < x_end; j++) {
+    // Отсечение слаботекстурированных областей (для кэша маска - все единицы)
+    if (!textured[j]) {
+      disparity_row[j] = 0;
+      totals->texture_skipped++;
+      continue;
+    }
+
+    // Диапазон диспаратностей, для которых окно остается внутри правого изображения
+    int d_begin = MAX(min_disparity, j - (width - half_block - 2));
+    int d_end = MIN(min_disparity + num_disparities, j - half_block + 1);
+    if (job->guide && d_begin < d_end)
+      guide_range(job->guide, i, j, job->match_chunk, &d_begin, &d_end);
+
+    // Поиск наилучшей диспаратности: окно левого вида не должно выходить за
+    // края изображения. Маска текстуры отмечает края как текстурированные при
+    // texture_threshold <= 0 (и для кэша), поэтому столбцы проверяются здесь
+    StereoBMMatch match = {0, INT_MAX, INT_MAX};
+    if (d_begin < d_end && row_valid && j >= half_block && j < width - half_block) {
+      totals->candidates += d_end - d_begin;
+      if (!volume) {
+        match_hinted(job, j, i - job->row_offset, half_block, d_begin, d_end, hint, &match);
+        if (match.best_cost != INT_MAX)
+          hint = match.best_disparity;
+      } else {
+        stereobm_cost_select(volume + (size_t)(j - volume_begin) * num_disparities,
+                             d_begin - min_disparity, d_end - min_disparity, &match);
+        match.best_disparity += min_disparity;
+      }
+    }
+
+    if (cache) {
+      cache->best_disparity[cache_row + j] = (int16_t)match.best_disparity;
+      cache->best_cost[cache_row + j] = match.best_cost;
+      cache->second_best_cost[cache_row + j] = match.second_best_cost;
+      cache->right_disparity[cache_row + j] = right_disparity && match.best_cost != INT_MAX ?
+                                              right_disparity[j - match.best_disparity] : -1;
+      continue;
+    }
+    int16_t value = match_validate(match.best_disparity, match.best_cost,
+                                   match.second_best_cost, params->uniqueness_ratio);
+    if (value > 0 && right_disparity &&
+        !lr_consistent(right_disparity[j - match.best_disparity], match.best_disparity,
+                       params->disp12_max_diff)) {
+      value = 0;
+      totals->lr_rejected++;
+    }
+    disparity_row[j] = value;
+    if (value > 0) {
+      totals->min_disp = MIN(totals->min_disp, value);
+      totals->max_disp = MAX(totals->max_disp, value);
+    }
+  }
+}
+
+// Вычисление диспаратности для строк полосы; диапазон найденных значений
+// и счетчики накапливаются в totals по ходу записи карты. Строки идут
+// группами по STEREOBM_TILE_ROWS: маски текстуры группы считаются по всей
+// ширине, затем каждая плитка столбцов проходит все строки группы, пока ее
+// строки изображений (или суммы столбцов объема) остаются в L2. Суммы
+// столбцов у каждой плитки свои (с полями half_block), сдвигаются по строкам
+// независимо и переходят в следующую группу.
+static void stereobm_compute_rows(StereoBMJob *job, StereoBMRowScratch *scratch,
+                                  int y_begin, int y_end, StereoBMRowTotals *totals) {
+  const StereoBMParams *params = job->params;
+  int width = job->width;
+  int height = job->height;
+  int half_block = params->block_size / 2;
+  StereoBMMatchCache *cache = job->cache;
+  // Для кэша ищутся все пиксели, текстура только запоминается
+  int texture_threshold = cache ? INT_MIN : params->texture_threshold;
+  int tile_width = job->tile_width;
+
+  // Рабочие буферы (у каждого потока свои)
+  int columns_ready = 0;
+  uint16_t *volume = job->cost_volume ? scratch->volume : NULL;
+  int volume_ready = 0;
+  int16_t *right_disparity = params->disp12_max_diff >= 0 ? scratch->right_disparity : NULL;
+
+  for (int group = y_begin; group < y_end; group += STEREOBM_TILE_ROWS) {
+    if (job->cancel && atomic_load(job->cancel))
+      break;
+
+    int group_end = MIN(group + STEREOBM_TILE_ROWS, y_end);
+
+    // Текстура строк по скользящим суммам: O(1) на пиксель вместо block_size^2
+    double texture_start = stereobm_time_now();
+    for (int i = group; i < group_end; i++)
+      texture_row(job->left_filtered, width, height, job->row_offset, i, half_block, job->tab,
+                  texture_threshold, scratch->col_sum, &columns_ready,
+                  scratch->textured + (size_t)(i - group) * width,
+                  cache ? cache->texture + (size_t)i * width : NULL);
+    totals->texture_seconds += stereobm_time_now() - texture_start;
+
+    int group_ready = volume_ready;
+    uint16_t *col_cost = scratch->volume_col;
+
+    for (int x_begin = 0; x_begin < width; x_begin += tile_width) {
+      int x_end = MIN(x_begin + tile_width, width);
+      int sum_begin = MAX(0, x_begin - half_block);
+      int sum_end = MIN(width, x_end + half_block);
+
+      volume_ready = group_ready;
+      for (int i = group; i < group_end; i++) {
+        int row_valid = i >= half_block && i < height - half_block;
+        if (volume && row_valid) {
+          cost_volume_row(job, i, half_block, sum_begin, sum_end, col_cost, &volume_ready,
+                          scratch->volume_window, volume);
+          if (right_disparity)
+            stereobm_right_disparity_row(volume, width, half_block, params->min_disparity,
+                                         params->num_disparities, scratch->right_cost,
+                                         right_disparity);
+        } else {
+          volume_ready = 0;
         }
+
+        match_row(job, i, x_begin, x_end, scratch->textured + (size_t)(i - group) * width,
+                  volume, sum_begin, right_disparity, totals);
       }
+      if (volume)
+        col_cost += (size_t)(sum_end - sum_begin) * params->num_disparities;
+    }
+
+    atomic_fetch_add(&job->rows_done, group_end - group);
+  }
+}
+
+static void row_totals_merge(StereoBMRowTotals *totals, const StereoBMRowTotals *part) {
+  totals->min_disp = MIN(totals->min_disp, part->min_disp);
+  totals->max_disp = MAX(totals->max_disp, part->max_disp);
+  totals->texture_skipped += part->texture_skipped;
+  totals->candidates += part->candidates;
+  totals->lr_rejected += part->lr_rejected;
+  totals->texture_seconds += part->texture_seconds;
+}
+
+// Рабочий поток: забирает полосы, пока они не закончатся
+static void *stereobm_stripe_worker(void *data) {
+  StereoBMJob *job = data;
+  StereoBMRowScratch *scratch = &job->scratch[atomic_fetch_add(&job->next_worker, 1)];
+  StereoBMRowTotals totals = { INT_MAX, 0, 0, 0, 0, 0.0 };
+  int s;
+
+  while ((s = atomic_fetch_add(&job->next_stripe, 1)) < job->num_stripes)
+    stereobm_compute_rows(job, scratch, job->stripes[s].y_begin, job->stripes[s].y_end,
+                          &totals);
+
+  pthread_mutex_lock(&job->mutex);
+  row_totals_merge(&job->totals, &totals);
+  job->threads_left--;
+  pthread_cond_signal(&job->cond);
+  pthread_mutex_unlock(&job->mutex);
+  return NULL;
+}
+
+static void report_progress(StereoBMProgressFunc progress, void *progress_data, double fraction) {
+  if (progress)
+    progress(fraction, progress_data);
+}
+
+// Основная функция вычисления карты диспаратности
+int16_t *stereobm_compute(const uint8_t *left_img, const uint8_t *right_img,
+                      int width, int height, const StereoBMParams *params,
+                      StereoBMProgressFunc progress, void *progress_data) {
+  // Выделение памяти для отфильтрованных изображений
+  uint8_t *left_filtered = malloc((size_t)width * height);
+  uint8_t *right_filtered = malloc((size_t)width * height);
+  int16_t *disparity_map = NULL;
+
+  if (left_filtered && right_filtered) {
+    // Предварительная фильтрация обоих изображений
+    prefilter_xsobel(left_img, left_filtered, width, height, params->pre_filter_cap);
+    prefilter_xsobel(right_img, right_filtered, width, height, params->pre_filter_cap);
+
+    disparity_map = stereobm_compute_filtered(left_filtered, right_filtered, width, height,
+                                              params, NULL, progress, progress_data);
+  }
+
+  free(left_filtered);
+  free(right_filtered);
 
-      // проверка качества
-      if (best_cost == G_MAXINT) {
-        disparity_map[i * width + j] = 0;
+  return disparity_map;
+}
+
+// Поиск по уже отфильтрованным изображениям (текстура + сопоставление)
+int16_t *stereobm_compute_filtered(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                               int width, int height, const StereoBMParams *params,
+                               StereoBMStats *stats,
+                               StereoBMProgressFunc progress, void *progress_data) {
+  if (params->sgm_paths > 0)
+    return stereobm_compute_sgm(left_filtered, right_filtered, width, height,
+                                params, stats, progress, progress_data);
+
+  int16_t *disparity_map = malloc((size_t)width * height * sizeof(int16_t));
+
+  if (disparity_map &&
+      stereobm_compute_band(left_filtered, right_filtered, width, height, 0, 0, height,
+                            params, disparity_map, NULL, NULL, stats, progress, progress_data)) {
+    free(disparity_map);
+    return NULL;
+  }
+  return disparity_map;
+}
+
+// Уменьшение отфильтрованного изображения в 2 раза (среднее по 2x2)
+static void pyramid_downsample(const uint8_t *src, int width, int dst_width, int dst_height,
+                               uint8_t *dst) {
+  for (int y = 0; y < dst_height; y++) {
+    const uint8_t *s0 = src + (size_t)y * 2 * width;
+    const uint8_t *s1 = s0 + width;
+    uint8_t *d = dst + (size_t)y * dst_width;
+    for (int x = 0; x < dst_width; x++)
+      d[x] = (uint8_t)((s0[2 * x] + s0[2 * x + 1] + s1[2 * x] + s1[2 * x + 1] + 2) >> 2);
+  }
+}
+
+// Грубый уровень пирамиды для строк [y_begin, y_end): поиск на уменьшенной
+// паре с половиной диапазона диспаратностей (рекурсивно для следующих
+// уровней). Уровень - часть уменьшенного изображения высотой height / 2:
+// строки окрестности guide_range() с полем stereobm_band_margin() грубого
+// уровня, уменьшенные из строк полосы, поэтому карта полосы совпадает с
+// картой всего изображения. *coarse_map - карта для guide или NULL, если
+// изображение слишком мало; -1 - нехватка памяти.
+static int pyramid_guide(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                         int width, int height, int row_offset, int y_begin, int y_end,
+                         const StereoBMParams *params, StereoBMGuide *guide,
+                         int16_t **coarse_map) {
+  int coarse_width = width / 2;
+  int coarse_height = height / 2;
+
+  *coarse_map = NULL;
+  if (coarse_width <= params->block_size + 1 || coarse_height <= params->block_size)
+    return 0;
+
+  StereoBMParams coarse = *params;
+  coarse.min_disparity = params->min_disparity / 2;
+  coarse.num_disparities = (params->min_disparity + params->num_disparities + 1) / 2 -
+                           coarse.min_disparity;
+  coarse.pyramid_levels = params->pyramid_levels - 1;
+  // Грубая оценка задает только центр диапазона: проверка уникальности на
+  // уменьшенной паре отбрасывает почти все пиксели (соседние d почти равны)
+  coarse.uniqueness_ratio = 0;
+  coarse.disp12_max_diff = -1;
+
+  // Строки грубой карты, которые читает guide_range(), и их поле
+  int coarse_margin = stereobm_band_margin(&coarse);
+  int coarse_begin = MAX(y_begin / 2 - 1, 0);
+  int coarse_end = MIN((y_end - 1) / 2 + 2, coarse_height);
+  int first = MAX(coarse_begin - coarse_margin, 0);
+  int last = MIN(coarse_end + coarse_margin, coarse_height);
+  int rows = coarse_end - coarse_begin;
+
+  uint8_t *coarse_left = malloc((size_t)coarse_width * (last - first));
+  uint8_t *coarse_right = malloc((size_t)coarse_width * (last - first));
+  int16_t *map = malloc((size_t)coarse_width * rows * sizeof(int16_t));
+  if (!coarse_left || !coarse_right || !map) {
+    free(coarse_left);
+    free(coarse_right);
+    free(map);
+    return -1;
+  }
+
+  pyramid_downsample(left_filtered + (size_t)(2 * first - row_offset) * width, width,
+                     coarse_width, last - first, coarse_left);
+  pyramid_downsample(right_filtered + (size_t)(2 * first - row_offset) * width, width,
+                     coarse_width, last - first, coarse_right);
+
+  int result = stereobm_compute_band(coarse_left, coarse_right, coarse_width, coarse_height,
+                                     first, coarse_begin, coarse_end, &coarse, map, NULL, NULL,
+                                     NULL, NULL, NULL);
+
+  free(coarse_left);
+  free(coarse_right);
+  if (result) {
+    free(map);
+    return -1;
+  }
+
+  *coarse_map = map;
+  guide->disparity_map = map;
+  guide->width = coarse_width;
+  guide->height = coarse_height;
+  guide->row_begin = coarse_begin;
+  guide->shift = 1;
+  guide->radius = MAX(params->pyramid_radius, 1);
+  return 0;
+}
+
+// Оценка диапазона: SAD-поиск по всему заданному диапазону в узлах сетки
+// с шагом STEREOBM_RANGE_GRID (только текстурированные окна, обычная
+// проверка уникальности). Диапазон - от 0.5 до 99.5 процентиля найденных
+// диспаратностей с запасом STEREOBM_RANGE_MARGIN, число диспаратностей
+// округляется вверх до кратного 16 (шаг SIMD-ядер). Census ищется по той же
+// оценке: нужна только граница диапазона, а не сами значения.
+#define STEREOBM_RANGE_MARGIN 8
+#define STEREOBM_RANGE_MIN_SAMPLES 64
+
+int stereobm_range_grid_row(const StereoBMParams *params, int y) {
+  int first = params->block_size / 2 + STEREOBM_RANGE_GRID / 2;
+
+  return y <= first ? first : first + (y - first + STEREOBM_RANGE_GRID - 1) /
+                                        STEREOBM_RANGE_GRID * STEREOBM_RANGE_GRID;
+}
+
+int stereobm_range_sample(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                          int width, int height, int row_offset, int y_begin, int y_end,
+                          const StereoBMParams *params, int *histogram) {
+  int half_block = params->block_size / 2;
+  int min_d = params->min_disparity;
+  int max_d = params->min_disparity + params->num_disparities;
+  StereoBMMatchFunc match_func = stereobm_select_match_func(params);
+  int samples = 0;
+  uint8_t tab[256];
+
+  texture_tab_init(tab, params->pre_filter_cap);
+
+  int y_first = stereobm_range_grid_row(params, y_begin);
+  int y_last = MIN(y_end, height - half_block - 1);
+  for (int y = y_first; y < y_last; y += STEREOBM_RANGE_GRID) {
+    for (int x = half_block + STEREOBM_RANGE_GRID / 2; x < width - half_block - 1;
+         x += STEREOBM_RANGE_GRID) {
+      int d_begin = MAX(min_d, x - (width - half_block - 2));
+      int d_end = MIN(max_d, x - half_block + 1);
+      if (d_begin >= d_end)
         continue;
-      } 
 
-      gint uniqueness_threshold;
-      if (best_cost > 0) {
-          uniqueness_threshold = (best_cost * params->uniqueness_ratio) / 100;
-      } else {
-          uniqueness_threshold = 0;  
+      int texture = 0;
+      for (int r = y - half_block; r <= y + half_block; r++) {
+        const uint8_t *row = left_filtered + (size_t)(r - row_offset) * width;
+        for (int c = x - half_block; c <= x + half_block; c++)
+          texture += tab[row[c]];
       }
+      if (texture < params->texture_threshold)
+        continue;
 
-      // Проверка с минимальным порогом 
-      if (second_best_cost == G_MAXINT) {
-          disparity_map[i * width + j] = (best_disparity + min_disparity) * 16;
-      } else if (second_best_cost - best_cost > uniqueness_threshold) {
-          disparity_map[i * width + j] = (best_disparity + min_disparity) * 16;
-      } else {
-          disparity_map[i * width + j] = 0;
+      StereoBMMatch match = {0, INT_MAX, INT_MAX};
+      match_func(left_filtered, right_filtered, width, x, y - row_offset, half_block,
+                 d_begin, d_end, &match);
+      if (match_validate(match.best_disparity, match.best_cost, match.second_best_cost,
+                         params->uniqueness_ratio) > 0) {
+        histogram[match.best_disparity]++;
+        samples++;
       }
     }
- 
-    // Обновление прогресса
-    if (i % 10 == 0) {
-      gdouble progress = (gdouble)(i - half_block) / (gdouble)(height - 2 * half_block);
-      gimp_progress_update(progress);
+  }
+  return samples;
+}
+
+void stereobm_range_finish(const int *histogram, int samples, const StereoBMParams *params,
+                           StereoBMParams *estimated) {
+  int min_d = params->min_disparity;
+  int max_d = params->min_disparity + params->num_disparities;
+
+  *estimated = *params;
+  estimated->auto_range = 0;
+
+  // Мало точек - остается заданный диапазон
+  if (samples >= STEREOBM_RANGE_MIN_SAMPLES) {
+    int tail = samples / 200, lo = min_d, hi = max_d - 1;
+    for (int count = 0; lo < max_d && (count += histogram[lo]) <= tail; lo++)
+      ;
+    for (int count = 0; hi > lo && (count += histogram[hi]) <= tail; hi--)
+      ;
+
+    int first = MAX(min_d, lo - STEREOBM_RANGE_MARGIN);
+    int last = MIN(max_d, hi + STEREOBM_RANGE_MARGIN + 1);
+    int num = MIN((last - first + 15) / 16 * 16, params->num_disparities);
+    estimated->min_disparity = MIN(first, max_d - num);
+    estimated->num_disparities = num;
+  }
+}
+
+void stereobm_estimate_range(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                             int width, int height, int row_offset, int y_begin, int y_end,
+                             const StereoBMParams *params, StereoBMParams *estimated) {
+  int *histogram = calloc(params->min_disparity + params->num_disparities, sizeof(int));
+  int samples = 0;
+
+  if (histogram)
+    samples = stereobm_range_sample(left_filtered, right_filtered, width, height, row_offset,
+                                    y_begin, y_end, params, histogram);
+  stereobm_range_finish(histogram, samples, params, estimated);
+  free(histogram);
+}
+
+// Поиск для строк [y_begin, y_end) по полосе отфильтрованных изображений;
+// -1 - нехватка памяти
+static int compute_band(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                         int width, int height, int row_offset, int y_begin, int y_end,
+                         const StereoBMParams *params, int16_t *disparity_map,
+                         const StereoBMBandOptions *options,
+                         StereoBMProgressFunc progress, void *progress_data) {
+  static const StereoBMBandOptions no_options = { NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+  int rows = y_end - y_begin;
+  StereoBMGuide guide;
+  int16_t *coarse_map = NULL;
+  StereoBMParams ranged;
+
+  if (!options)
+    options = &no_options;
+
+  StereoBMStats *stats = options->stats;
+  double stage_start = stereobm_time_now();
+
+  // Автоматический диапазон: оценка по разреженной сетке этой же полосы,
+  // дальше (и на грубых уровнях пирамиды) - обычный поиск в узком диапазоне
+  if (params->auto_range) {
+    stereobm_estimate_range(left_filtered, right_filtered, width, height, row_offset,
+                            y_begin, y_end, params, &ranged);
+    params = &ranged;
+    stereobm_stats_stage(stats, STEREOBM_STAGE_RANGE, &stage_start);
+  }
+
+  // Пирамида: полный поиск только на грубом уровне, здесь - узкий диапазон
+  if (params->pyramid_levels > 0 && !options->prior) {
+    if (pyramid_guide(left_filtered, right_filtered, width, height, row_offset,
+                      y_begin, y_end, params, &guide, &coarse_map))
+      return -1;
+    stereobm_stats_stage(stats, STEREOBM_STAGE_PYRAMID, &stage_start);
+  }
+
+  StereoBMJob job;
+  job.left_filtered = left_filtered;
+  job.right_filtered = right_filtered;
+  job.disparity_map = disparity_map;
+  job.width = width;
+  job.height = height;
+  job.row_offset = row_offset;
+  job.out_offset = y_begin;
+  job.params = params;
+  job.cache = options->cache;
+  job.cancel = options->cancel;
+
+  // Таблица для вычисления текстуры
+  texture_tab_init(job.tab, params->pre_filter_cap);
+
+  // Ядро поиска выбирается по возможностям процессора
+  job.match_func = stereobm_select_match_func(params);
+  job.match_chunk = job.match_func == stereobm_match_scalar ? 1 : 16;
+  job.guide = options->prior ? options->prior : coarse_map ? &guide : NULL;
+
+  // Census-дескрипторы строк окон полосы считаются один раз
+  int census_first = 0, census_last = 0;
+  if (params->cost_type != STEREOBM_COST_SAD) {
+    int half_block = params->block_size / 2;
+    census_first = MAX(0, y_begin - half_block);
+    census_last = MAX(MIN(height, y_end + half_block), census_first);
+  }
+  size_t census_count = (size_t)width * (census_last - census_first);
+
+  // Число потоков: 0 - по числу процессоров
+  int num_threads = params->num_threads > 0 ? params->num_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  num_threads = CLAMP(num_threads, 1, MAX(rows, 1));
+
+  // Рабочие буферы потоков и дескрипторы: переданные или в одной арене на
+  // время вызова
+  StereoBMBuffers *buffers = options->buffers;
+  StereoBMBuffers local;
+  void *arena = NULL;
+  if (!buffers || buffers->num_scratch < num_threads ||
+      buffers->census_count < 2 * census_count) {
+    StereoBMArena layout = { NULL, 0 };
+    buffers_layout(&layout, &local, width, num_threads, 2 * census_count, params);
+    arena = stereobm_arena_alloc(layout.size);
+    if (!arena) {
+      free(coarse_map);
+      return -1;
+    }
+    layout = (StereoBMArena){ arena, 0 };
+    buffers_layout(&layout, &local, width, num_threads, 2 * census_count, params);
+    buffers = &local;
+  }
+  job.scratch = buffers->scratch;
+
+  job.census_left = job.census_right = NULL;
+  if (params->cost_type != STEREOBM_COST_SAD) {
+    uint64_t *census = buffers->census;
+
+    stereobm_census_rows(left_filtered, width, height, row_offset, census_first, census_last,
+                         params->cost_type, census);
+    stereobm_census_rows(right_filtered, width, height, row_offset, census_first, census_last,
+                         params->cost_type, census + census_count);
+    job.census_left = census;
+    job.census_right = census + census_count;
+    job.census_offset = census_first;
+    job.census_slide = stereobm_select_census_func();
+  }
+  job.cost_volume = cost_volume_used(params);
+  if (job.cost_volume)
+    job.match_chunk = 1;
+
+  // Плитки - те, под которые выделены буферы (у последовательности - по
+  // исходным параметрам, автоматический диапазон их только сужает)
+  job.tile_width = job.scratch[0].tile_width;
+  atomic_init(&job.next_worker, 0);
+
+  // Полос больше, чем потоков, чтобы сгладить неравномерность
+  // (слаботекстурированные строки обрабатываются быстрее)
+  int num_stripes = num_threads == 1 ? 1 : MIN(num_threads * 4, rows);
+  job.stripes = malloc(num_stripes * sizeof(StereoBMStripe));
+  if (!job.stripes) {
+    free(coarse_map);
+    free(arena);
+    return -1;
+  }
+  job.num_stripes = num_stripes;
+  for (int s = 0; s < num_stripes; s++) {
+    job.stripes[s].y_begin = y_begin + (int)((int64_t)rows * s / num_stripes);
+    job.stripes[s].y_end = y_begin + (int)((int64_t)rows * (s + 1) / num_stripes);
+  }
+  atomic_init(&job.next_stripe, 0);
+  atomic_init(&job.rows_done, 0);
+  job.totals = (StereoBMRowTotals){ options->min_disp ? *options->min_disp : INT_MAX,
+                                     options->max_disp ? *options->max_disp : 0, 0, 0, 0, 0.0 };
+
+  // Без массива потоков считается в текущем (как если бы ни один не запустился)
+  pthread_t *threads = num_threads > 1 ? malloc(num_threads * sizeof(pthread_t)) : NULL;
+  if (!threads)
+    num_threads = 1;
+
+  if (num_threads > 1) {
+    pthread_mutex_init(&job.mutex, NULL);
+    pthread_cond_init(&job.cond, NULL);
+    job.threads_left = 0;
+
+    pthread_mutex_lock(&job.mutex);
+    for (int t = 0; t < num_threads; t++) {
+      if (pthread_create(&threads[t], NULL, stereobm_stripe_worker, &job) != 0)
+        break;
+      job.threads_left++;
+    }
+    int started = job.threads_left;
+
+    // Прогресс сообщается только из вызывающего потока
+    while (job.threads_left > 0) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += 100 * 1000 * 1000;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&job.cond, &job.mutex, &deadline);
+
+      pthread_mutex_unlock(&job.mutex);
+      report_progress(progress, progress_data, (double)atomic_load(&job.rows_done) / rows);
+      pthread_mutex_lock(&job.mutex);
     }
+    pthread_mutex_unlock(&job.mutex);
+
+    for (int t = 0; t < started; t++)
+      pthread_join(threads[t], NULL);
+    free(threads);
+    pthread_mutex_destroy(&job.mutex);
+    pthread_cond_destroy(&job.cond);
+
+    // Если ни один поток не запустился, досчитываем в текущем
+    if (started == 0)
+      num_threads = 1;
   }
 
-  g_free(left_filtered);
-  g_free(right_filtered);
+  if (num_threads == 1) {
+    // Однопоточный режим: по 10 строк между обновлениями прогресса
+    for (int i = y_begin; i < y_end; i += 10) {
+      stereobm_compute_rows(&job, &job.scratch[0], i, MIN(i + 10, y_end), &job.totals);
+      report_progress(progress, progress_data, (double)atomic_load(&job.rows_done) / rows);
+    }
+  }
+  report_progress(progress, progress_data, 1.0);
 
-  return disparity_map;
+  if (options->min_disp) {
+    *options->min_disp = job.totals.min_disp;
+    *options->max_disp = job.totals.max_disp;
+  }
+  if (stats) {
+    stereobm_stats_stage(stats, STEREOBM_STAGE_MATCHING, &stage_start);
+    stats->seconds[STEREOBM_STAGE_TEXTURE] += job.totals.texture_seconds;
+    stats->pixels += (long long)width * rows;
+    stats->texture_skipped += job.totals.texture_skipped;
+    stats->candidates += job.totals.candidates;
+    stats->lr_rejected += job.totals.lr_rejected;
+  }
+
+  free(job.stripes);
+  free(coarse_map);
+  free(arena);
+  return 0;
 }
 
-// Функция для цветной нормализации карты диспаратности
-void normalize_disparity_map_color(gint *disparity_map, guchar *output, 
-                                   gint width, gint height, gint num_disparities) {
-  
-  gint min_disp = G_MAXINT;
-  gint max_disp = 0;
+int stereobm_compute_band(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                           int width, int height, int row_offset, int y_begin, int y_end,
+                           const StereoBMParams *params, int16_t *disparity_map,
+                           int *min_disp, int *max_disp, StereoBMStats *stats,
+                           StereoBMProgressFunc progress, void *progress_data) {
+  StereoBMBandOptions options = { NULL, NULL, NULL, NULL, min_disp, max_disp, stats };
+
+  return compute_band(left_filtered, right_filtered, width, height, row_offset, y_begin, y_end,
+                      params, disparity_map, &options, progress, progress_data);
+}
+
+StereoBMContext *stereobm_context_new(void) {
+  return calloc(1, sizeof(StereoBMContext));
+}
+
+void stereobm_context_free(StereoBMContext *context) {
+  if (!context)
+    return;
+
+  free(context->arena);
+  free(context->sgm_work);
+  free(context);
+}
+
+// Раскладка контекста для полосы из rows строк карты шириной width (изображение
+// высотой height): буферы потоков и census-дескрипторы строк полосы с полями
+// окна; при frame - еще отфильтрованные виды и карта всего изображения
+static void context_layout(StereoBMArena *arena, StereoBMContext *context, int width, int height,
+                           int rows, int frame, const StereoBMParams *params) {
+  int num_threads = params->num_threads > 0 ? params->num_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  size_t census_count = 0;
+
+  if (params->cost_type != STEREOBM_COST_SAD)
+    census_count = 2 * (size_t)width * MIN(height, rows + params->block_size - 1);
+  context->left_filtered = context->right_filtered = NULL;
+  context->disparity_map = NULL;
+  if (frame) {
+    size_t count = (size_t)width * height;
+    context->left_filtered = stereobm_arena_take(arena, count);
+    context->right_filtered = stereobm_arena_take(arena, count);
+    context->disparity_map = stereobm_arena_take(arena, count * sizeof(int16_t));
+  }
+  // Буферы SGM - в отдельном блоке (sgm_frame)
+  if (params->sgm_paths > 0 && frame) {
+    memset(&context->buffers, 0, sizeof(context->buffers));
+    return;
+  }
+  buffers_layout(arena, &context->buffers, width, CLAMP(num_threads, 1, MAX(rows, 1)),
+                 census_count, params);
+}
+
+// Арена под раскладку (растет только при нехватке) и указатели в ней; 0 - успех
+static int context_prepare(StereoBMContext *context, int width, int height, int rows, int frame,
+                           const StereoBMParams *params) {
+  StereoBMArena layout = { NULL, 0 };
+
+  context_layout(&layout, context, width, height, rows, frame, params);
+  if (block_reserve(&context->arena, &context->capacity, layout.size))
+    return -1;
+  layout = (StereoBMArena){ context->arena, 0 };
+  context_layout(&layout, context, width, height, rows, frame, params);
+  return 0;
+}
 
-  for (gint i = 0; i < width * height; i++) {
+int stereobm_context_compute_band(StereoBMContext *context,
+                                  const uint8_t *left_filtered, const uint8_t *right_filtered,
+                                  int width, int height, int row_offset, int y_begin, int y_end,
+                                  const StereoBMParams *params, int16_t *disparity_map,
+                                  int *min_disp, int *max_disp, StereoBMStats *stats,
+                                  StereoBMProgressFunc progress, void *progress_data) {
+  if (context_prepare(context, width, height, y_end - y_begin, 0, params))
+    return -1;
+
+  StereoBMBandOptions options = { NULL, NULL, NULL, &context->buffers, min_disp, max_disp, stats };
+  return compute_band(left_filtered, right_filtered, width, height, row_offset, y_begin, y_end,
+                      params, disparity_map, &options, progress, progress_data);
+}
+
+const int16_t *stereobm_context_compute(StereoBMContext *context,
+                                        const uint8_t *left, const uint8_t *right,
+                                        size_t stride, int channels, int width, int height,
+                                        const StereoBMParams *params, StereoBMStats *stats,
+                                        StereoBMProgressFunc progress, void *progress_data) {
+  if (context_prepare(context, width, height, height, 1, params))
+    return NULL;
+
+  double stage_start = stereobm_time_now();
+  if (stereobm_prefilter_view(left, stride, width, height, channels, params->pre_filter_cap,
+                              context->left_filtered) ||
+      stereobm_prefilter_view(right, stride, width, height, channels, params->pre_filter_cap,
+                              context->right_filtered))
+    return NULL;
+  stereobm_stats_stage(stats, STEREOBM_STAGE_PREFILTER, &stage_start);
+
+  if (params->sgm_paths > 0) {
+    if (sgm_frame(context->left_filtered, context->right_filtered, width, height, params,
+                  &context->sgm_work, &context->sgm_capacity, context->disparity_map, stats,
+                  progress, progress_data))
+      return NULL;
+  } else {
+    StereoBMBandOptions options = { NULL, NULL, NULL, &context->buffers, NULL, NULL, stats };
+    if (compute_band(context->left_filtered, context->right_filtered, width, height, 0, 0,
+                     height, params, context->disparity_map, &options, progress, progress_data))
+      return NULL;
+  }
+  return context->disparity_map;
+}
+
+// Заполнение кэша предпросмотра по изображениям целиком
+int stereobm_cache_compute(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                           int width, int height, const StereoBMParams *params,
+                           const atomic_int *cancel, StereoBMMatchCache *cache) {
+  size_t count = (size_t)width * height;
+
+  if (cache->width != width || cache->height != height) {
+    stereobm_cache_free(cache);
+    cache->best_disparity = malloc(count * sizeof(int16_t));
+    cache->best_cost = malloc(count * sizeof(int32_t));
+    cache->second_best_cost = malloc(count * sizeof(int32_t));
+    cache->texture = malloc(count * sizeof(int32_t));
+    cache->right_disparity = malloc(count * sizeof(int16_t));
+    if (!cache->best_disparity || !cache->best_cost || !cache->second_best_cost ||
+        !cache->texture || !cache->right_disparity) {
+      stereobm_cache_free(cache);
+      return -1;
+    }
+    cache->width = width;
+    cache->height = height;
+  }
+  cache->valid = 0;
+
+  StereoBMBandOptions options = { cache, cancel, NULL, NULL, NULL, NULL, NULL };
+  if (compute_band(left_filtered, right_filtered, width, height, 0, 0, height, params,
+                   NULL, &options, NULL, NULL))
+    return -1;
+  if (cancel && atomic_load(cancel))
+    return -1;
+
+  cache->params = *params;
+  cache->valid = 1;
+  return 0;
+}
+
+// Порог текстуры влияет на сопоставление только через грубый уровень пирамиды
+// и оценку автоматического диапазона (она же зависит от уникальности)
+int stereobm_cache_usable(const StereoBMMatchCache *cache, const StereoBMParams *params) {
+  const StereoBMParams *p = &cache->params;
+
+  return cache->valid && params->sgm_paths == 0 &&
+         p->num_disparities == params->num_disparities &&
+         p->min_disparity == params->min_disparity &&
+         p->auto_range == params->auto_range &&
+         (!params->auto_range || (p->texture_threshold == params->texture_threshold &&
+                                  p->uniqueness_ratio == params->uniqueness_ratio)) &&
+         p->block_size == params->block_size &&
+         p->pre_filter_cap == params->pre_filter_cap &&
+         p->pyramid_levels == params->pyramid_levels &&
+         p->pyramid_radius == params->pyramid_radius &&
+         p->cost_type == params->cost_type &&
+         (p->disp12_max_diff >= 0) == (params->disp12_max_diff >= 0) &&
+         (params->pyramid_levels == 0 || p->texture_threshold == params->texture_threshold);
+}
+
+// Проверки текстуры и уникальности по кэшу (то же, что в stereobm_compute_rows)
+void stereobm_cache_validate(const StereoBMMatchCache *cache, const StereoBMParams *params,
+                             int16_t *disparity_map) {
+  size_t count = (size_t)cache->width * cache->height;
+
+  for (size_t i = 0; i < count; i++) {
+    if (cache->texture[i] < params->texture_threshold)
+      disparity_map[i] = 0;
+    else
+      disparity_map[i] = match_validate(cache->best_disparity[i], cache->best_cost[i],
+                                        cache->second_best_cost[i], params->uniqueness_ratio);
+    if (disparity_map[i] > 0 && params->disp12_max_diff >= 0 &&
+        !lr_consistent(cache->right_disparity[i], cache->best_disparity[i],
+                       params->disp12_max_diff))
+      disparity_map[i] = 0;
+  }
+}
+
+void stereobm_cache_free(StereoBMMatchCache *cache) {
+  free(cache->best_disparity);
+  free(cache->best_cost);
+  free(cache->second_best_cost);
+  free(cache->texture);
+  free(cache->right_disparity);
+  memset(cache, 0, sizeof(*cache));
+}
+
+// Обновление диапазона найденных (положительных) диспаратностей;
+// перед первым вызовом *min_disp = INT_MAX, *max_disp = 0
+void stereobm_disparity_minmax(const int16_t *disparity_map, size_t count,
+                               int *min_disp, int *max_disp) {
+  for (size_t i = 0; i < count; i++) {
     if (disparity_map[i] > 0) {
-      if (disparity_map[i] < min_disp) min_disp = disparity_map[i];
-      if (disparity_map[i] > max_disp) max_disp = disparity_map[i];
+      if (disparity_map[i] < *min_disp) *min_disp = disparity_map[i];
+      if (disparity_map[i] > *max_disp) *max_disp = disparity_map[i];
     }
   }
-  
-  if (min_disp == G_MAXINT) {
+}
+
+// Таблица цветового кодирования по диапазону [min_disp, max_disp]: цвет
+// каждого значения карты считается так же, как раньше для каждого пикселя
+void stereobm_colormap_init(StereoBMColormap *colormap, int min_disp, int max_disp,
+                            int num_disparities) {
+  if (min_disp == INT_MAX) {
     min_disp = 0;
-    max_disp = num_disparities * 16;
+    max_disp = num_disparities * STEREOBM_DISP_SCALE;
   }
   
-  gint range = max_disp - min_disp;
+  int range = max_disp - min_disp;
   if (range == 0) range = 1;
   
-  for (gint i = 0; i < width * height; i++) {
-      gint idx = i * 3;
-      gfloat normalized = (gfloat)(disparity_map[i] - min_disp) / range;
+  for (int value = 0; value < STEREOBM_COLORMAP_SIZE; value++) {
+      float normalized = (float)(value - min_disp) / range;
 
-      gint r, g, b;
+      int r, g, b;
 
       if (normalized < 0.125) {
         r = 0;
         g = 0;
-        b = 128 + (gint)(normalized * 8 * 127); 
+        b = 128 + (int)(normalized * 8 * 127); 
       } else if (normalized < 0.375) {
         r = 0;
-        g = (gint)((normalized - 0.125) * 4 * 255);
+        g = (int)((normalized - 0.125) * 4 * 255);
         b = 255;
       } else if (normalized < 0.625) {
-        r = (gint)((normalized - 0.375) * 4 * 255);
+        r = (int)((normalized - 0.375) * 4 * 255);
         g = 255;
-        b = (gint)((0.625 - normalized) * 4 * 255);
+        b = (int)((0.625 - normalized) * 4 * 255);
       } else if (normalized < 0.875) {
         r = 255;
-        g = (gint)((0.875 - normalized) * 4 * 255);
+        g = (int)((0.875 - normalized) * 4 * 255);
         b = 0;
       } else {
         r = 255;
@@ -220,8 +1485,146 @@ void normalize_disparity_map_color(gint *disparity_map, guchar *output,
         b = 0;
       }
 
-      output[idx] = r;     // R
-      output[idx + 1] = g; // G
-      output[idx + 2] = b; // B
+      // Компоненты усекаются до байта, как при записи в uint8_t
+      colormap->rgb[value] = (uint32_t)(uint8_t)r | (uint32_t)(uint8_t)g << 8 |
+                             (uint32_t)(uint8_t)b << 16;
   }
-}
\ No newline at end of file
+}
+
+void stereobm_colormap_apply(const StereoBMColormap *colormap, const int16_t *disparity_map,
+                             uint8_t *output, size_t count) {
+  stereobm_select_colormap_func()(colormap->rgb, disparity_map, output, count);
+}
+
+// Цветное кодирование по диапазону [min_disp, max_disp]
+void stereobm_colorize(const int16_t *disparity_map, uint8_t *output, size_t count,
+                       int min_disp, int max_disp, int num_disparities) {
+  StereoBMColormap colormap;
+
+  stereobm_colormap_init(&colormap, min_disp, max_disp, num_disparities);
+  stereobm_colormap_apply(&colormap, disparity_map, output, count);
+}
+
+// Функция для цветной нормализации карты диспаратности
+void normalize_disparity_map_color(const int16_t *disparity_map, uint8_t *output,
+                                   int width, int height, int num_disparities) {
+  int min_disp = INT_MAX;
+  int max_disp = 0;
+  size_t count = (size_t)width * height;
+
+  stereobm_disparity_minmax(disparity_map, count, &min_disp, &max_disp);
+  stereobm_colorize(disparity_map, output, count, min_disp, max_disp, num_disparities);
+}
+
+// Последовательность кадров: все буферы - в одной арене, выделенной один раз
+struct StereoBMSequence {
+  int width;
+  int height;
+  StereoBMParams params;
+  int temporal_radius;
+  int refresh_interval;
+  long frame;                   // номер следующего кадра
+  uint8_t *left_filtered;
+  uint8_t *right_filtered;
+  int16_t *disparity[2];        // текущая и предыдущая карты (по очереди)
+  int current;
+  StereoBMBuffers buffers;
+  void *arena;
+  void *sgm_work;               // буферы SGM (см. StereoBMContext)
+  size_t sgm_capacity;
+};
+
+static void sequence_layout(StereoBMArena *arena, StereoBMSequence *sequence, int num_scratch) {
+  size_t count = (size_t)sequence->width * sequence->height;
+  int census = sequence->params.cost_type != STEREOBM_COST_SAD;
+
+  sequence->left_filtered = stereobm_arena_take(arena, count);
+  sequence->right_filtered = stereobm_arena_take(arena, count);
+  // Карты не обнуляются: первый кадр всегда считается полным поиском и
+  // предыдущую карту не читает
+  sequence->disparity[0] = stereobm_arena_take(arena, count * sizeof(int16_t));
+  sequence->disparity[1] = stereobm_arena_take(arena, count * sizeof(int16_t));
+  if (sequence->params.sgm_paths > 0)
+    memset(&sequence->buffers, 0, sizeof(sequence->buffers));
+  else
+    buffers_layout(arena, &sequence->buffers, sequence->width, num_scratch,
+                   census ? 2 * count : 0, &sequence->params);
+}
+
+StereoBMSequence *stereobm_sequence_new(int width, int height, const StereoBMParams *params,
+                                        int temporal_radius, int refresh_interval) {
+  StereoBMSequence *sequence = calloc(1, sizeof(StereoBMSequence));
+
+  if (!sequence)
+    return NULL;
+  sequence->width = width;
+  sequence->height = height;
+  sequence->params = *params;
+  sequence->temporal_radius = MAX(temporal_radius, 0);
+  sequence->refresh_interval = refresh_interval;
+
+  // Столько же буферов потоков, сколько потоков запустит compute_band()
+  int num_threads = params->num_threads > 0 ? params->num_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int num_scratch = CLAMP(num_threads, 1, MAX(height, 1));
+  StereoBMArena layout = { NULL, 0 };
+
+  sequence_layout(&layout, sequence, num_scratch);
+  sequence->arena = stereobm_arena_alloc(layout.size);
+  if (!sequence->arena) {
+    free(sequence);
+    return NULL;
+  }
+  layout = (StereoBMArena){ sequence->arena, 0 };
+  sequence_layout(&layout, sequence, num_scratch);
+  return sequence;
+}
+
+const int16_t *stereobm_sequence_frame(StereoBMSequence *sequence,
+                                       const uint8_t *left, const uint8_t *right,
+                                       size_t stride, int channels) {
+  const StereoBMParams *params = &sequence->params;
+  int width = sequence->width, height = sequence->height;
+
+  if (stereobm_prefilter_view(left, stride, width, height, channels, params->pre_filter_cap,
+                              sequence->left_filtered) ||
+      stereobm_prefilter_view(right, stride, width, height, channels, params->pre_filter_cap,
+                              sequence->right_filtered))
+    return NULL;
+
+  const int16_t *previous = sequence->disparity[sequence->current];
+  int16_t *disparity_map = sequence->disparity[sequence->current ^ 1];
+  int result;
+
+  if (params->sgm_paths > 0) {
+    result = sgm_frame(sequence->left_filtered, sequence->right_filtered, width, height, params,
+                       &sequence->sgm_work, &sequence->sgm_capacity, disparity_map,
+                       NULL, NULL, NULL);
+  } else {
+    // Полный поиск на первом кадре и раз в refresh_interval кадров
+    int refresh = sequence->temporal_radius == 0 || sequence->frame == 0 ||
+                  (sequence->refresh_interval > 0 &&
+                   sequence->frame % sequence->refresh_interval == 0);
+    StereoBMGuide prior = { previous, width, height, 0, 0, sequence->temporal_radius };
+    StereoBMBandOptions options = { NULL, NULL, refresh ? NULL : &prior, &sequence->buffers,
+                                    NULL, NULL, NULL };
+
+    result = compute_band(sequence->left_filtered, sequence->right_filtered, width, height,
+                          0, 0, height, params, disparity_map, &options, NULL, NULL);
+  }
+
+  // При ошибке предыдущая карта остается prior следующего кадра
+  if (result)
+    return NULL;
+  sequence->current ^= 1;
+  sequence->frame++;
+  return disparity_map;
+}
+
+void stereobm_sequence_free(StereoBMSequence *sequence) {
+  if (!sequence)
+    return;
+
+  free(sequence->arena);
+  free(sequence->sgm_work);
+  free(sequence);
+}
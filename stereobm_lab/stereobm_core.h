@@ -0,0 +1,390 @@
+#ifndef STEREOBM_CORE_H
+#define STEREOBM_CORE_H
+
+// libstereobm: вычислительное ядро StereoBM на чистом C, без GIMP и GLib.
+// Используется плагином GIMP и консольной утилитой stereobm-cli.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Диспаратность хранится в int16 с 4 дробными битами (как CV_16S в OpenCV):
+// значение = диспаратность * 16, 0 - диспаратность не найдена
+#define STEREOBM_DISP_SHIFT 4
+#define STEREOBM_DISP_SCALE (1 << STEREOBM_DISP_SHIFT)
+
+// Стоимость сопоставления окна
+typedef enum {
+  STEREOBM_COST_SAD = 0,      // сумма абсолютных разностей после X-Sobel
+  STEREOBM_COST_CENSUS_5X5,   // расстояние Хэмминга census 5x5 (24 бита)
+  STEREOBM_COST_CENSUS_7X9    // census 7 строк x 9 столбцов (62 бита)
+} StereoBMCostType;
+
+typedef struct {
+  int num_disparities;
+  int min_disparity;     // поиск по [min_disparity, min_disparity + num_disparities)
+  int auto_range;        // 1 - диапазон по разреженному поиску внутри заданного
+  int block_size;
+  int pre_filter_cap;
+  int texture_threshold;
+  int uniqueness_ratio;
+  int disp12_max_diff;   // LR-проверка: допустимая разность с правым видом, <0 - выключена
+  int num_threads;       // 0 - по числу процессоров
+  int cache_bytes;       // L2 для плиток столбцов: 0 - sysconf, <0 - без плиток
+  int pyramid_levels;    // 0 - полный поиск, 1/2 - грубая оценка в 2/4 раза меньшем масштабе
+  int pyramid_radius;    // полуширина диапазона поиска вокруг грубой оценки
+  StereoBMCostType cost_type;
+  int sgm_paths;         // 0 - блочное сопоставление, 4 или 8 - SGM
+  int sgm_p1;            // штрафы SGM на пиксель окна (умножаются на block_size^2)
+  int sgm_p2;
+} StereoBMParams;
+
+// Результат поиска по диапазону диспаратностей для одного пикселя
+typedef struct {
+  int best_disparity;
+  int best_cost;
+  int second_best_cost;
+} StereoBMMatch;
+
+// Ядро поиска: SAD-стоимости для d из [d_begin, d_end) с учетом лучшей и
+// второй по качеству стоимости (все d диапазона должны быть внутри изображения)
+typedef void (*StereoBMMatchFunc)(const uint8_t *left, const uint8_t *right,
+                                  int width, int x, int y, int half_block,
+                                  int d_begin, int d_end, StereoBMMatch *match);
+
+// Прогресс вычисления в диапазоне [0, 1]; вызывается только из потока,
+// вызвавшего stereobm_compute()
+typedef void (*StereoBMProgressFunc)(double fraction, void *user_data);
+
+// Стадии для замеров времени. Чтение, фильтрацию, цвет и запись замеряет
+// вызывающий код (плагин, утилита), остальное - функции поиска.
+typedef enum {
+  STEREOBM_STAGE_READ = 0,    // чтение изображения (gegl_buffer_get, файл)
+  STEREOBM_STAGE_PREFILTER,   // разделение, градации серого, X-Sobel
+  STEREOBM_STAGE_RANGE,       // оценка автоматического диапазона
+  STEREOBM_STAGE_PYRAMID,     // грубые уровни пирамиды
+  STEREOBM_STAGE_MATCHING,    // census-дескрипторы и поиск (вместе с текстурой)
+  STEREOBM_STAGE_TEXTURE,     // маска текстуры, сумма по потокам поиска
+  STEREOBM_STAGE_COLORIZE,    // нормализация и цвет
+  STEREOBM_STAGE_WRITE,       // запись результата
+  STEREOBM_NUM_STAGES
+} StereoBMStage;
+
+// Время стадий (секунды по CLOCK_MONOTONIC) и счетчики; значения
+// прибавляются, перед первым вызовом структура обнуляется
+typedef struct {
+  double seconds[STEREOBM_NUM_STAGES];
+  long long pixels;            // пикселей карты
+  long long texture_skipped;   // не искались: текстура окна ниже порога
+  long long candidates;        // оцененных пар (пиксель, диспаратность)
+  long long lr_rejected;       // отброшены LR-проверкой
+} StereoBMStats;
+
+// Имя стадии ("read", "prefilter", ...), текущее время CLOCK_MONOTONIC
+// в секундах и учет стадии: прибавляет now - *since к stats (если не NULL)
+// и переносит *since на текущее время
+const char *stereobm_stage_name(StereoBMStage stage);
+double stereobm_time_now(void);
+void stereobm_stats_stage(StereoBMStats *stats, StereoBMStage stage, double *since);
+
+// Параметры по умолчанию (совпадают с диалогом плагина)
+void stereobm_params_init(StereoBMParams *params);
+
+// Имена стоимостей для командной строки: "sad", "census5", "census7".
+// stereobm_parse_cost() возвращает 0 при успехе.
+const char *stereobm_cost_name(StereoBMCostType cost_type);
+int stereobm_parse_cost(const char *name, StereoBMCostType *cost_type);
+
+// Совмещенный проход: выделение вида, градации серого (BT.601 в фиксированной
+// точке) и X-Sobel. image - первый пиксель вида, stride - байт на строку,
+// channels = 1 или 3 (RGB). Функции фильтрации возвращают 0 или -1 при
+// нехватке памяти (строки серого для RGB).
+int stereobm_prefilter_view(const uint8_t *image, size_t stride, int width, int height,
+                            int channels, int pre_filter_cap, uint8_t *output);
+
+// Фильтрация обеих половин side-by-side изображения; width - ширина всего
+// изображения, выходные буферы - (width / 2) * height
+int stereobm_prefilter_sbs(const uint8_t *image, int width, int height, int channels,
+                           int pre_filter_cap, uint8_t *left_filtered, uint8_t *right_filtered);
+
+// То же для строк [y_begin, y_end) (обработка полосами): image указывает на
+// строку row_offset вида высотой height и содержит строки [y_begin - 1, y_end + 1)
+// в пределах изображения; строка y пишется в output + (y - y_begin) * width
+int stereobm_prefilter_view_rows(const uint8_t *image, size_t stride, int width, int height,
+                                 int channels, int pre_filter_cap, int row_offset,
+                                 int y_begin, int y_end, uint8_t *output);
+
+void prefilter_xsobel(const uint8_t *input, uint8_t *output,
+                      int width, int height, int pre_filter_cap);
+
+// Карта диспаратности (int16, значения * 16), освобождается free();
+// NULL - нехватка памяти. progress может быть NULL.
+int16_t *stereobm_compute(const uint8_t *left_img, const uint8_t *right_img,
+                      int width, int height, const StereoBMParams *params,
+                      StereoBMProgressFunc progress, void *progress_data);
+
+// Отдельные стадии stereobm_compute(): поиск по отфильтрованным
+// изображениям (при sgm_paths > 0 - stereobm_compute_sgm(); NULL - нехватка
+// памяти) и маска текстуры (1 - пиксель участвует в поиске; -1 - нехватка памяти)
+int16_t *stereobm_compute_filtered(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                               int width, int height, const StereoBMParams *params,
+                               StereoBMStats *stats,
+                               StereoBMProgressFunc progress, void *progress_data);
+// Поиск для строк [y_begin, y_end) изображения высотой height по полосе
+// отфильтрованных изображений, начинающейся со строки row_offset и содержащей
+// строки [y_begin - margin, y_end + margin) в пределах изображения, где
+// margin = stereobm_band_margin(params).
+// Результат - (y_end - y_begin) строк в disparity_map. Без auto_range (диапазон
+// оценивается по полосе) они совпадают со строками карты всего изображения:
+// при pyramid_levels > 0 грубые уровни строятся по строкам той же полосы,
+// margin включает их поля. Если min_disp/max_disp не NULL,
+// они обновляются диапазоном найденных диспаратностей полосы, как
+// stereobm_disparity_minmax(), но по ходу поиска. В stats (может быть NULL)
+// прибавляются время стадий поиска и счетчики полосы. Возвращает 0 или -1 при
+// нехватке памяти (рабочие буферы, грубый уровень), карта тогда не заполнена.
+int stereobm_compute_band(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                          int width, int height, int row_offset, int y_begin, int y_end,
+                          const StereoBMParams *params, int16_t *disparity_map,
+                          int *min_disp, int *max_disp, StereoBMStats *stats,
+                          StereoBMProgressFunc progress, void *progress_data);
+// Строки контекста над и под полосой для stereobm_compute_band()
+// (half_block, для census - плюс полуразмер окна census; при pyramid_levels > 0
+// это поле грубого уровня, удвоенное на каждый уровень, плюс 3)
+int stereobm_band_margin(const StereoBMParams *params);
+// То же по горизонтали: столбцы контекста левого вида слева и справа от
+// области карты (правому виду слева нужны еще min_disparity + num_disparities - 1;
+// при pyramid_levels > 0 - поле грубых уровней, левый край области выравнивается
+// на 1 << pyramid_levels)
+int stereobm_column_margin(const StereoBMParams *params);
+// Ширина плитки столбцов, которые блочное сопоставление проходит по всем
+// строкам полосы, прежде чем перейти к следующей (width - без разбиения)
+int stereobm_tile_width(const StereoBMParams *params, int width);
+// Диапазон диспаратностей строк [y_begin, y_end) по разреженному поиску
+// (полоса - как в stereobm_compute_band()): estimated - копия params
+// с суженными min_disparity/num_disparities внутри заданных и auto_range = 0.
+// При auto_range поиск вызывает ее сам; если найдено мало точек, диапазон
+// не меняется.
+void stereobm_estimate_range(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                             int width, int height, int row_offset, int y_begin, int y_end,
+                             const StereoBMParams *params, StereoBMParams *estimated);
+// Оценка по частям, когда изображение целиком не хранится (плагин читает
+// только строки окон сетки). Узлы сетки - строки half_block +
+// STEREOBM_RANGE_GRID / 2 с шагом STEREOBM_RANGE_GRID (независимо от полосы)
+// и столбцы с тем же шагом; stereobm_range_grid_row() - первая строка сетки,
+// не меньшая y. stereobm_range_sample() прибавляет точки строк сетки из
+// [y_begin, y_end) в histogram из min_disparity + num_disparities счетчиков
+// и возвращает их число; полоса начинается со строки row_offset и содержит
+// строки [y_begin - half_block, y_end + half_block) в пределах изображения.
+// stereobm_range_finish() по накопленной гистограмме заполняет estimated,
+// как stereobm_estimate_range().
+#define STEREOBM_RANGE_GRID 8
+int stereobm_range_grid_row(const StereoBMParams *params, int y);
+int stereobm_range_sample(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                          int width, int height, int row_offset, int y_begin, int y_end,
+                          const StereoBMParams *params, int *histogram);
+void stereobm_range_finish(const int *histogram, int samples, const StereoBMParams *params,
+                           StereoBMParams *estimated);
+
+// Кэш предпросмотра: результаты блочного сопоставления для всех пикселей до
+// проверок текстуры и уникальности. Пока меняются только texture_threshold,
+// uniqueness_ratio, num_threads и порог disp12_max_diff (но не включение
+// LR-проверки), карта пересобирается stereobm_cache_validate() без повторного
+// сопоставления. Начальное состояние - все поля нулевые.
+typedef struct {
+  int width;
+  int height;
+  int valid;
+  StereoBMParams params;       // параметры, с которыми заполнен кэш
+  int16_t *best_disparity;     // в пикселях
+  int32_t *best_cost;          // INT_MAX - кандидатов нет
+  int32_t *second_best_cost;
+  int32_t *texture;            // сумма текстуры окна (0 вне рабочей области)
+  int16_t *right_disparity;    // правый вид в точке совпадения (-1 - нет или LR выключена)
+} StereoBMMatchCache;
+
+// Заполнение кэша (только блочное сопоставление, sgm_paths не учитывается).
+// cancel (может быть NULL) проверяется перед каждой строкой; при отмене или
+// нехватке памяти возвращает -1 и кэш остается недействительным.
+int stereobm_cache_compute(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                           int width, int height, const StereoBMParams *params,
+                           const atomic_int *cancel, StereoBMMatchCache *cache);
+// 1 - кэш можно использовать для params
+int stereobm_cache_usable(const StereoBMMatchCache *cache, const StereoBMParams *params);
+void stereobm_cache_validate(const StereoBMMatchCache *cache, const StereoBMParams *params,
+                             int16_t *disparity_map);
+void stereobm_cache_free(StereoBMMatchCache *cache);
+
+// Последовательность кадров (стереовидео) одного размера и с одними
+// параметрами: отфильтрованные изображения, карты, census-дескрипторы и
+// рабочие буферы потоков выделяются один раз, одним блоком (NULL - нехватка
+// памяти). При temporal_radius > 0 поиск
+// каждого пикселя ограничен диапазоном [min - radius, max + radius] по
+// диспаратностям окрестности 3x3 предыдущего кадра (без них - полный поиск),
+// полный поиск повторяется на каждом refresh_interval-м кадре (0 - только
+// на первом). Пирамида используется только в кадрах с полным поиском; для
+// SGM кадры считаются независимо.
+typedef struct StereoBMSequence StereoBMSequence;
+
+StereoBMSequence *stereobm_sequence_new(int width, int height, const StereoBMParams *params,
+                                        int temporal_radius, int refresh_interval);
+// Кадр: left/right - первые пиксели видов (channels = 1 или 3), stride - байт
+// на строку (для side-by-side оба вида лежат в одном изображении). Карта
+// принадлежит последовательности и действительна до следующего кадра; NULL -
+// нехватка памяти (буферы SGM выделяются при первом кадре и растут, если
+// auto_range расширил диапазон), prior следующего кадра тогда не меняется.
+const int16_t *stereobm_sequence_frame(StereoBMSequence *sequence,
+                                       const uint8_t *left, const uint8_t *right,
+                                       size_t stride, int channels);
+void stereobm_sequence_free(StereoBMSequence *sequence);
+
+// Раскладка рабочих буферов в одном блоке, выровненном на 64 байта (строка
+// кэша). Раскладка проходится дважды: с base = NULL stereobm_arena_take()
+// только считает размер, затем те же вызовы раздают указатели из блока
+// stereobm_arena_alloc() (освобождается free(); NULL - нехватка памяти).
+#define STEREOBM_ARENA_ALIGN 64
+
+typedef struct {
+  uint8_t *base;          // NULL - подсчет размера
+  size_t size;
+} StereoBMArena;
+
+void *stereobm_arena_take(StereoBMArena *arena, size_t size);
+void *stereobm_arena_alloc(size_t size);
+
+// Контекст вычисления: один блок памяти, выровненный на 64 байта, под
+// рабочие буферы потоков, census-дескрипторы и (для stereobm_context_compute)
+// отфильтрованные виды, карту и буферы путей SGM (отдельным блоком). Блок растет до наибольшего запроса и
+// переиспользуется следующими вызовами без повторного выделения и обнуления,
+// поэтому кадры одного размера (пакетная обработка, полосы плагина) не платят
+// за страничные промахи. Контекст не потокобезопасен: по одному на поток.
+typedef struct StereoBMContext StereoBMContext;
+
+StereoBMContext *stereobm_context_new(void);
+void stereobm_context_free(StereoBMContext *context);
+// stereobm_compute_band() с буферами контекста; -1 - нехватка памяти
+int stereobm_context_compute_band(StereoBMContext *context,
+                                  const uint8_t *left_filtered, const uint8_t *right_filtered,
+                                  int width, int height, int row_offset, int y_begin, int y_end,
+                                  const StereoBMParams *params, int16_t *disparity_map,
+                                  int *min_disp, int *max_disp, StereoBMStats *stats,
+                                  StereoBMProgressFunc progress, void *progress_data);
+// Фильтрация и поиск для пары width x height (виды - как в
+// stereobm_sequence_frame). Карта принадлежит контексту и действительна до
+// следующего вызова с ним; NULL - нехватка памяти.
+const int16_t *stereobm_context_compute(StereoBMContext *context,
+                                        const uint8_t *left, const uint8_t *right,
+                                        size_t stride, int channels, int width, int height,
+                                        const StereoBMParams *params, StereoBMStats *stats,
+                                        StereoBMProgressFunc progress, void *progress_data);
+
+// Semi-global matching (stereobm_sgm.c): стоимость окна cost_type для каждого
+// (x, d), агрегация по sgm_paths путям со штрафами sgm_p1/sgm_p2. Нужны
+// изображения целиком (пути проходят через все строки), текстура не
+// проверяется; память путей - O(width * nd), полная сумма путей хранится,
+// только если помещается в бюджет (иначе один проход без путей снизу).
+// NULL - нехватка памяти.
+int16_t *stereobm_compute_sgm(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                              int width, int height, const StereoBMParams *params,
+                              StereoBMStats *stats,
+                              StereoBMProgressFunc progress, void *progress_data);
+// То же в буферы вызывающего (контекст, последовательность кадров): карта
+// width * height и рабочий блок stereobm_sgm_work_size() байт из
+// stereobm_arena_alloc(). auto_range здесь не учитывается: диапазон params
+// окончательный (stereobm_estimate_range() - до подсчета размера).
+size_t stereobm_sgm_work_size(int width, int height, const StereoBMParams *params);
+void stereobm_compute_sgm_work(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                               int width, int height, const StereoBMParams *params,
+                               void *work, int16_t *disparity_map, StereoBMStats *stats,
+                               StereoBMProgressFunc progress, void *progress_data);
+int stereobm_texture_mask(const uint8_t *left_filtered, int width, int height,
+                          const StereoBMParams *params, uint8_t *mask);
+
+// Нормализация по частям (для обработки полосами): диапазон найденных
+// диспаратностей накапливается по всем полосам (начальные значения INT_MAX и 0),
+// затем каждая полоса кодируется цветом. Блочное сопоставление может вернуть
+// диапазон само (stereobm_compute_band), без отдельного прохода по карте.
+void stereobm_disparity_minmax(const int16_t *disparity_map, size_t count,
+                               int *min_disp, int *max_disp);
+void stereobm_colorize(const int16_t *disparity_map, uint8_t *output, size_t count,
+                       int min_disp, int max_disp, int num_disparities);
+
+// Цветовая шкала как таблица RGB на каждое значение карты: значения не больше
+// 255 * 16 + 15 < 4096, так что при кодировании нет ни деления, ни ветвлений.
+// Таблица строится один раз на диапазон и применяется ко всем полосам.
+#define STEREOBM_COLORMAP_SIZE 4096
+
+typedef struct {
+  uint32_t rgb[STEREOBM_COLORMAP_SIZE];  // байты R, G, B, 0
+} StereoBMColormap;
+
+void stereobm_colormap_init(StereoBMColormap *colormap, int min_disp, int max_disp,
+                            int num_disparities);
+void stereobm_colormap_apply(const StereoBMColormap *colormap, const int16_t *disparity_map,
+                             uint8_t *output, size_t count);
+
+void normalize_disparity_map_color(const int16_t *disparity_map, uint8_t *output,
+                                   int width, int height, int num_disparities);
+
+// SIMD-ядра поиска (stereobm_simd.c). stereobm_select_match_func() для
+// block_size 3..21 возвращает вариант с развернутым окном
+void stereobm_match_scalar(const uint8_t *left, const uint8_t *right,
+                           int width, int x, int y, int half_block,
+                           int d_begin, int d_end, StereoBMMatch *match);
+void stereobm_match_sse2(const uint8_t *left, const uint8_t *right,
+                         int width, int x, int y, int half_block,
+                         int d_begin, int d_end, StereoBMMatch *match);
+void stereobm_match_avx2(const uint8_t *left, const uint8_t *right,
+                         int width, int x, int y, int half_block,
+                         int d_begin, int d_end, StereoBMMatch *match);
+StereoBMMatchFunc stereobm_select_match_func(const StereoBMParams *params);
+StereoBMMatchFunc stereobm_select_generic_match_func(const StereoBMParams *params);
+
+// Кодирование по таблице StereoBMColormap (stereobm_simd.c): скалярно и
+// AVX2 gather с выбором по CPUID
+typedef void (*StereoBMColormapFunc)(const uint32_t *colormap, const int16_t *disparity_map,
+                                     uint8_t *output, size_t count);
+void stereobm_colormap_scalar(const uint32_t *colormap, const int16_t *disparity_map,
+                              uint8_t *output, size_t count);
+void stereobm_colormap_avx2(const uint32_t *colormap, const int16_t *disparity_map,
+                            uint8_t *output, size_t count);
+StereoBMColormapFunc stereobm_select_colormap_func(void);
+
+// Census-стоимость (stereobm_census.c). Дескрипторы считаются один раз по
+// отфильтрованным изображениям, стоимости окна - скользящими суммами
+// расстояний Хэмминга: столбцы окна сдвигаются по строкам, окно - по x.
+void stereobm_census_rows(const uint8_t *image, int width, int height, int row_offset,
+                          int y_begin, int y_end, StereoBMCostType cost_type,
+                          uint64_t *output);
+// Стоимости столбцов x из [x_begin, x_end) хранятся с x_begin для
+// d = min_disparity + k, k < num_disparities.
+typedef void (*StereoBMCensusSlideFunc)(const uint64_t *left_add, const uint64_t *right_add,
+                                        const uint64_t *left_sub, const uint64_t *right_sub,
+                                        int x_begin, int x_end, int min_disparity,
+                                        int num_disparities, uint16_t *col_cost);
+void stereobm_census_slide_scalar(const uint64_t *left_add, const uint64_t *right_add,
+                                  const uint64_t *left_sub, const uint64_t *right_sub,
+                                  int x_begin, int x_end, int min_disparity,
+                                  int num_disparities, uint16_t *col_cost);
+void stereobm_census_slide_popcnt(const uint64_t *left_add, const uint64_t *right_add,
+                                  const uint64_t *left_sub, const uint64_t *right_sub,
+                                  int x_begin, int x_end, int min_disparity,
+                                  int num_disparities, uint16_t *col_cost);
+StereoBMCensusSlideFunc stereobm_select_census_func(void);
+// То же для SAD по строкам отфильтрованных изображений
+void stereobm_sad_slide(const uint8_t *left_add, const uint8_t *right_add,
+                        const uint8_t *left_sub, const uint8_t *right_sub,
+                        int x_begin, int x_end, int min_disparity, int num_disparities,
+                        uint16_t *col_cost);
+void stereobm_census_box_row(const uint16_t *col_cost, int width, int half_block,
+                             int num_disparities, uint16_t *window, uint16_t *cost);
+void stereobm_cost_select(const uint16_t *cost, int d_begin, int d_end,
+                          StereoBMMatch *match);
+// LR-проверка: диспаратность правого вида для каждого x по строке объема
+// стоимостей cost[x * nd + d - min_disparity] (-1 - нет допустимых d)
+void stereobm_right_disparity_row(const uint16_t *cost, int width, int half_block,
+                                  int min_disparity, int num_disparities,
+                                  uint16_t *right_cost, int16_t *right_disparity);
+void stereobm_xsobel_row(const uint8_t *r0, const uint8_t *r1, const uint8_t *r2,
+                         int width, int pre_filter_cap, uint8_t *out);
+
+#endif
@@ -1,11 +1,272 @@
 #include "stereobm.h"
+#include <string.h>
+#include <math.h>
 
-// Диалог параметров
-gboolean stereobm_dialog(StereoBMParams *params) {
+// Ширина вида в предпросмотре: поиск идет по уменьшенной копии пары
+#define STEREOBM_PREVIEW_WIDTH 320
+
+// Задержка перед пересчетом предпросмотра после изменения параметра, мс
+#define STEREOBM_PREVIEW_DELAY 150
+
+// Предпросмотр: сопоставление уменьшенной пары в фоновом потоке. Пока поток
+// работает, его данные (отфильтрованные изображения, кэш, карта) доступны
+// только ему; основной поток читает их после g_thread_join().
+typedef struct {
+  GtkWidget *dialog;
+  GtkWidget *area;
+  gint width;                  // размер вида в предпросмотре
+  gint height;
+  gdouble scale;               // уменьшение относительно исходного вида
+  guchar *source;              // уменьшенная side-by-side пара (RGB)
+  guchar *left_filtered;
+  guchar *right_filtered;
+  gint filtered_cap;           // pre_filter_cap отфильтрованных (0 - нет)
+  StereoBMMatchCache cache;
+  gint16 *disparity;
+  guchar *rgb;
+
+  GThread *thread;             // NULL - вычисление не идет
+  atomic_int cancel;
+  StereoBMParams job_params;   // параметры текущего вычисления
+  gboolean pending;            // параметры изменились во время вычисления
+  gboolean failed;             // libstereobm не хватило памяти, карта не обновлена
+  guint timeout_id;
+} StereoBMPreview;
+
+static void dialog_get_params(GtkWidget *dialog, StereoBMParams *params) {
+  GtkWidget *widget;
+  
+  widget = g_object_get_data(G_OBJECT(dialog), "num-disparities");
+  params->num_disparities = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget));
+  
+  widget = g_object_get_data(G_OBJECT(dialog), "min-disparity");
+  params->min_disparity = MIN(gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget)),
+                              256 - params->num_disparities);
+  
+  widget = g_object_get_data(G_OBJECT(dialog), "auto-range");
+  params->auto_range = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget));
+  
+  widget = g_object_get_data(G_OBJECT(dialog), "block-size");
+  params->block_size = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget));
+  
+  widget = g_object_get_data(G_OBJECT(dialog), "pre-filter-cap");
+  params->pre_filter_cap = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget));
+  
+  widget = g_object_get_data(G_OBJECT(dialog), "texture-threshold");
+  params->texture_threshold = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget));
+  
+  widget = g_object_get_data(G_OBJECT(dialog), "uniqueness-ratio");
+  params->uniqueness_ratio = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget));
+  
+  widget = g_object_get_data(G_OBJECT(dialog), "disp12-max-diff");
+  params->disp12_max_diff = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget));
+  
+  widget = g_object_get_data(G_OBJECT(dialog), "pyramid-levels");
+  params->pyramid_levels = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget));
+  
+  widget = g_object_get_data(G_OBJECT(dialog), "cost-type");
+  params->cost_type = gtk_combo_box_get_active(GTK_COMBO_BOX(widget));
+  
+  widget = g_object_get_data(G_OBJECT(dialog), "sgm-paths");
+  params->sgm_paths = (gint)g_ascii_strtoll(gtk_combo_box_get_active_id(GTK_COMBO_BOX(widget)),
+                                            NULL, 10);
+  
+  widget = g_object_get_data(G_OBJECT(dialog), "sgm-p1");
+  params->sgm_p1 = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget));
+  
+  widget = g_object_get_data(G_OBJECT(dialog), "sgm-p2");
+  params->sgm_p2 = MAX(gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget)),
+                       params->sgm_p1);
+  
+  widget = g_object_get_data(G_OBJECT(dialog), "num-threads");
+  params->num_threads = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget));
+}
+
+// Уменьшенная копия side-by-side пары. Масштаб выбирается так, чтобы граница
+// видов попадала на целый пиксель.
+static gboolean preview_init(StereoBMPreview *preview, GimpDrawable *drawable) {
+  gint width = gimp_drawable_get_width(drawable);
+  gint height = gimp_drawable_get_height(drawable);
+
+  memset(preview, 0, sizeof(*preview));
+  if (width % 2 != 0 || width < 4)
+    return FALSE;
+
+  preview->width = MIN(width / 2, STEREOBM_PREVIEW_WIDTH);
+  preview->scale = (gdouble)preview->width / (width / 2);
+  preview->height = MAX((gint)(height * preview->scale), 1);
+
+  gsize count = (gsize)preview->width * preview->height;
+  preview->source = g_new(guchar, count * 2 * 3);
+  preview->left_filtered = g_new(guchar, count);
+  preview->right_filtered = g_new(guchar, count);
+  preview->disparity = g_new0(gint16, count);
+  preview->rgb = g_new(guchar, count * 3);
+
+  GeglBuffer *buffer = gimp_drawable_get_buffer(drawable);
+  gegl_buffer_get(buffer, GEGL_RECTANGLE(0, 0, preview->width * 2, preview->height),
+                  preview->scale, babl_format("R'G'B' u8"), preview->source,
+                  GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_CLAMP);
+  g_object_unref(buffer);
+
+  preview->area = gimp_preview_area_new();
+  gtk_widget_set_size_request(preview->area, preview->width, preview->height);
+  return TRUE;
+}
+
+// Параметры для уменьшенной пары: диапазон диспаратностей масштабируется,
+// окно остается прежним, чтобы пороги текстуры и уникальности значили то же
+static void preview_params(const StereoBMPreview *preview, StereoBMParams *params) {
+  gint num_disparities = (gint)ceil(params->num_disparities * preview->scale);
+
+  params->num_disparities = CLAMP((num_disparities + 15) / 16 * 16, 16, 256);
+  params->min_disparity = MIN((gint)floor(params->min_disparity * preview->scale),
+                              256 - params->num_disparities);
+}
+
+static gpointer preview_worker(gpointer data);
+
+static void preview_draw(StereoBMPreview *preview, const StereoBMParams *params) {
+  gsize count = (gsize)preview->width * preview->height;
+  gint min_disp = G_MAXINT;
+  gint max_disp = 0;
+
+  // Для блочного сопоставления - только дешевые проверки по кэшу
+  if (params->sgm_paths == 0)
+    stereobm_cache_validate(&preview->cache, params, preview->disparity);
+
+  stereobm_disparity_minmax(preview->disparity, count, &min_disp, &max_disp);
+  stereobm_colorize(preview->disparity, preview->rgb, count, min_disp, max_disp,
+                    params->min_disparity + params->num_disparities);
+  gimp_preview_area_draw(GIMP_PREVIEW_AREA(preview->area), 0, 0,
+                         preview->width, preview->height, GIMP_RGB_IMAGE,
+                         preview->rgb, preview->width * 3);
+}
+
+// Запуск пересчета по текущим значениям диалога
+static void preview_start(StereoBMPreview *preview) {
+  StereoBMParams params;
+
+  dialog_get_params(preview->dialog, &params);
+  preview_params(preview, &params);
+
+  // Поток еще работает: отменяется, перезапуск - после его завершения
+  if (preview->thread) {
+    preview->pending = TRUE;
+    atomic_store(&preview->cancel, 1);
+    return;
+  }
+
+  if (stereobm_cache_usable(&preview->cache, &params)) {
+    preview_draw(preview, &params);
+    return;
+  }
+
+  preview->job_params = params;
+  atomic_store(&preview->cancel, 0);
+  preview->thread = g_thread_new("stereobm-preview", preview_worker, preview);
+}
+
+// Завершение фонового вычисления (в основном потоке)
+static gboolean preview_done(gpointer data) {
+  StereoBMPreview *preview = data;
+
+  g_thread_join(preview->thread);
+  preview->thread = NULL;
+
+  if (preview->pending) {
+    preview->pending = FALSE;
+    preview_start(preview);
+  } else if (!atomic_load(&preview->cancel) && !preview->failed) {
+    preview_draw(preview, &preview->job_params);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+static gpointer preview_worker(gpointer data) {
+  StereoBMPreview *preview = data;
+  const StereoBMParams *params = &preview->job_params;
+  gint width = preview->width;
+  gint height = preview->height;
+
+  preview->failed = FALSE;
+  if (preview->filtered_cap != params->pre_filter_cap) {
+    preview->failed = stereobm_prefilter_sbs(preview->source, width * 2, height, 3,
+                                             params->pre_filter_cap, preview->left_filtered,
+                                             preview->right_filtered) != 0;
+    preview->filtered_cap = preview->failed ? 0 : params->pre_filter_cap;
+  }
+
+  // При ошибке предпросмотр остается прежним
+  if (preview->failed) {
+    g_idle_add(preview_done, preview);
+    return NULL;
+  }
+
+  if (params->sgm_paths > 0) {
+    // SGM не отменяется по ходу, результат отменённого прогона не показывается
+    gint16 *disparity_map = stereobm_compute_sgm(preview->left_filtered, preview->right_filtered,
+                                                 width, height, params, NULL, NULL, NULL);
+    if (disparity_map)
+      memcpy(preview->disparity, disparity_map, (gsize)width * height * sizeof(gint16));
+    preview->failed = disparity_map == NULL;
+    free(disparity_map);
+  } else {
+    // Ошибка без отмены - нехватка памяти
+    preview->failed = stereobm_cache_compute(preview->left_filtered, preview->right_filtered,
+                                             width, height, params, &preview->cancel,
+                                             &preview->cache) != 0 &&
+                      !atomic_load(&preview->cancel);
+  }
+
+  g_idle_add(preview_done, preview);
+  return NULL;
+}
+
+static gboolean preview_timeout(gpointer data) {
+  StereoBMPreview *preview = data;
+
+  preview->timeout_id = 0;
+  preview_start(preview);
+  return G_SOURCE_REMOVE;
+}
+
+// Изменение любого параметра: текущее вычисление отменяется сразу,
+// новое запускается после паузы в STEREOBM_PREVIEW_DELAY мс
+static void preview_changed(GtkWidget *widget, StereoBMPreview *preview) {
+  if (preview->thread)
+    atomic_store(&preview->cancel, 1);
+  if (preview->timeout_id)
+    g_source_remove(preview->timeout_id);
+  preview->timeout_id = g_timeout_add(STEREOBM_PREVIEW_DELAY, preview_timeout, preview);
+}
+
+static void preview_free(StereoBMPreview *preview) {
+  atomic_store(&preview->cancel, 1);
+  if (preview->thread)
+    g_thread_join(preview->thread);
+
+  // Ожидающие preview_done() и preview_timeout()
+  while (g_source_remove_by_user_data(preview))
+    ;
+
+  stereobm_cache_free(&preview->cache);
+  g_free(preview->source);
+  g_free(preview->left_filtered);
+  g_free(preview->right_filtered);
+  g_free(preview->disparity);
+  g_free(preview->rgb);
+}
+
+// Диалог параметров с предпросмотром по уменьшенной копии drawable
+gboolean stereobm_dialog(GimpDrawable *drawable, StereoBMParams *params, StereoBMOutput *output) {
   GtkWidget *dialog;
   GtkWidget *content_area;
   GtkWidget *grid;
   GtkWidget *spin_button;
+  GtkWidget *check_button;
+  GtkWidget *combo;
+  StereoBMPreview preview;
   gboolean run;
   
   // Инициализация UI системы GIMP
@@ -37,65 +298,170 @@ gboolean stereobm_dialog(StereoBMParams *params) {
   gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 0, 1, 1);
   g_object_set_data(G_OBJECT(dialog), "num-disparities", spin_button);
   
+  // Min Disparity (поиск по [min, min + num))
+  gtk_grid_attach(GTK_GRID(grid), gtk_label_new("Min Disparity:"),
+                  0, 1, 1, 1);
+  
+  spin_button = gtk_spin_button_new_with_range(0, 240, 1);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin_button), params->min_disparity);
+  gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 1, 1, 1);
+  g_object_set_data(G_OBJECT(dialog), "min-disparity", spin_button);
+  
+  // Auto Range: диапазон сужается по разреженному поиску внутри заданного
+  check_button = gtk_check_button_new_with_label("Auto Range");
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(check_button), params->auto_range);
+  gtk_grid_attach(GTK_GRID(grid), check_button, 1, 2, 1, 1);
+  g_object_set_data(G_OBJECT(dialog), "auto-range", check_button);
+  
   // Block Size
   gtk_grid_attach(GTK_GRID(grid), gtk_label_new("Block Size:"),
-                  0, 1, 1, 1);
+                  0, 3, 1, 1);
   
   spin_button = gtk_spin_button_new_with_range(3, 21, 2);
   gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin_button), params->block_size);
-  gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 1, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 3, 1, 1);
   g_object_set_data(G_OBJECT(dialog), "block-size", spin_button);
   
   // Pre Filter Cap
   gtk_grid_attach(GTK_GRID(grid), gtk_label_new("Pre Filter Cap:"),
-                  0, 2, 1, 1);
+                  0, 4, 1, 1);
   
   spin_button = gtk_spin_button_new_with_range(1, 63, 1);
   gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin_button), params->pre_filter_cap);
-  gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 2, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 4, 1, 1);
   g_object_set_data(G_OBJECT(dialog), "pre-filter-cap", spin_button);
   
   // Texture Threshold
   gtk_grid_attach(GTK_GRID(grid), gtk_label_new("Texture Threshold:"),
-                  0, 3, 1, 1);
+                  0, 5, 1, 1);
   
   spin_button = gtk_spin_button_new_with_range(0, 1000, 10);
   gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin_button), params->texture_threshold);
-  gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 3, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 5, 1, 1);
   g_object_set_data(G_OBJECT(dialog), "texture-threshold", spin_button);
   
   // Uniqueness Ratio
   gtk_grid_attach(GTK_GRID(grid), gtk_label_new("Uniqueness Ratio:"),
-                  0, 4, 1, 1);
+                  0, 6, 1, 1);
   
   spin_button = gtk_spin_button_new_with_range(0, 100, 5);
   gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin_button), params->uniqueness_ratio);
-  gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 4, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 6, 1, 1);
   g_object_set_data(G_OBJECT(dialog), "uniqueness-ratio", spin_button);
   
+  // LR Max Diff: проверка по правому виду из того же объема стоимостей
+  gtk_grid_attach(GTK_GRID(grid), gtk_label_new("LR Max Diff (-1 = off):"),
+                  0, 7, 1, 1);
+  
+  spin_button = gtk_spin_button_new_with_range(-1, 256, 1);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin_button), params->disp12_max_diff);
+  gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 7, 1, 1);
+  g_object_set_data(G_OBJECT(dialog), "disp12-max-diff", spin_button);
+  
+  // Pyramid Levels (0 - полный поиск, 1/2 - грубая оценка в 2/4 раза меньшем масштабе)
+  gtk_grid_attach(GTK_GRID(grid), gtk_label_new("Pyramid Levels (0 = off):"),
+                  0, 8, 1, 1);
+  
+  spin_button = gtk_spin_button_new_with_range(0, 2, 1);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin_button), params->pyramid_levels);
+  gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 8, 1, 1);
+  g_object_set_data(G_OBJECT(dialog), "pyramid-levels", spin_button);
+  
+  // Matching Cost (порядок совпадает с StereoBMCostType)
+  gtk_grid_attach(GTK_GRID(grid), gtk_label_new("Matching Cost:"),
+                  0, 9, 1, 1);
+  
+  combo = gtk_combo_box_text_new();
+  gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo), "SAD");
+  gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo), "Census 5x5");
+  gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo), "Census 7x9");
+  gtk_combo_box_set_active(GTK_COMBO_BOX(combo), params->cost_type);
+  gtk_grid_attach(GTK_GRID(grid), combo, 1, 9, 1, 1);
+  g_object_set_data(G_OBJECT(dialog), "cost-type", combo);
+  
+  // Semi-global matching: число путей (0 - блочное сопоставление)
+  gtk_grid_attach(GTK_GRID(grid), gtk_label_new("SGM Paths:"),
+                  0, 10, 1, 1);
+  
+  combo = gtk_combo_box_text_new();
+  gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(combo), "0", "Off (block matching)");
+  gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(combo), "4", "4 paths");
+  gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(combo), "8", "8 paths");
+  gtk_combo_box_set_active_id(GTK_COMBO_BOX(combo), params->sgm_paths == 8 ? "8" :
+                              params->sgm_paths == 4 ? "4" : "0");
+  gtk_grid_attach(GTK_GRID(grid), combo, 1, 10, 1, 1);
+  g_object_set_data(G_OBJECT(dialog), "sgm-paths", combo);
+  
+  // SGM P1 / P2 (штрафы на пиксель окна)
+  gtk_grid_attach(GTK_GRID(grid), gtk_label_new("SGM P1:"),
+                  0, 11, 1, 1);
+  
+  spin_button = gtk_spin_button_new_with_range(1, 64, 1);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin_button), params->sgm_p1);
+  gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 11, 1, 1);
+  g_object_set_data(G_OBJECT(dialog), "sgm-p1", spin_button);
+  
+  gtk_grid_attach(GTK_GRID(grid), gtk_label_new("SGM P2:"),
+                  0, 12, 1, 1);
+  
+  spin_button = gtk_spin_button_new_with_range(1, 256, 1);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin_button), params->sgm_p2);
+  gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 12, 1, 1);
+  g_object_set_data(G_OBJECT(dialog), "sgm-p2", spin_button);
+  
+  // Threads (0 - автоматически, по числу процессоров)
+  gtk_grid_attach(GTK_GRID(grid), gtk_label_new("Threads (0 = auto):"),
+                  0, 13, 1, 1);
+  
+  spin_button = gtk_spin_button_new_with_range(0, 256, 1);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin_button), params->num_threads);
+  gtk_grid_attach(GTK_GRID(grid), spin_button, 1, 13, 1, 1);
+  g_object_set_data(G_OBJECT(dialog), "num-threads", spin_button);
+  
+  // Вид результата (на предпросмотр не влияет)
+  gtk_grid_attach(GTK_GRID(grid), gtk_label_new("Output:"),
+                  0, 14, 1, 1);
+  
+  combo = gtk_combo_box_text_new();
+  gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo), "Color map");
+  gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo), "Gray 8-bit (disparity)");
+  gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo), "Gray 16-bit (disparity * 16)");
+  gtk_combo_box_set_active(GTK_COMBO_BOX(combo), *output);
+  gtk_grid_attach(GTK_GRID(grid), combo, 1, 14, 1, 1);
+  g_object_set_data(G_OBJECT(dialog), "output", combo);
+  
+  // Предпросмотр справа от параметров (только для side-by-side изображения)
+  if (preview_init(&preview, drawable)) {
+    static const gchar *const keys[] = {
+      "num-disparities", "min-disparity", "auto-range", "block-size", "pre-filter-cap", "texture-threshold",
+      "uniqueness-ratio", "disp12-max-diff", "pyramid-levels", "cost-type", "sgm-paths",
+      "sgm-p1", "sgm-p2", "num-threads"
+    };
+
+    preview.dialog = dialog;
+    gtk_widget_set_valign(preview.area, GTK_ALIGN_START);
+    gtk_grid_attach(GTK_GRID(grid), preview.area, 2, 0, 1, 15);
+
+    for (gsize i = 0; i < G_N_ELEMENTS(keys); i++) {
+      GtkWidget *widget = g_object_get_data(G_OBJECT(dialog), keys[i]);
+      g_signal_connect(widget, GTK_IS_SPIN_BUTTON(widget) ? "value-changed" :
+                       GTK_IS_TOGGLE_BUTTON(widget) ? "toggled" : "changed",
+                       G_CALLBACK(preview_changed), &preview);
+    }
+    preview_start(&preview);
+  }
+  
   gtk_widget_show_all(dialog);
   
   run = (gimp_dialog_run(GIMP_DIALOG(dialog)) == GTK_RESPONSE_OK);
   
   if (run) {
-    GtkWidget *widget;
-    
-    widget = g_object_get_data(G_OBJECT(dialog), "num-disparities");
-    params->num_disparities = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget));
-    
-    widget = g_object_get_data(G_OBJECT(dialog), "block-size");
-    params->block_size = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget));
-    
-    widget = g_object_get_data(G_OBJECT(dialog), "pre-filter-cap");
-    params->pre_filter_cap = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget));
-    
-    widget = g_object_get_data(G_OBJECT(dialog), "texture-threshold");
-    params->texture_threshold = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget));
-    
-    widget = g_object_get_data(G_OBJECT(dialog), "uniqueness-ratio");
-    params->uniqueness_ratio = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget));
+    dialog_get_params(dialog, params);
+    combo = g_object_get_data(G_OBJECT(dialog), "output");
+    *output = gtk_combo_box_get_active(GTK_COMBO_BOX(combo));
   }
   
+  preview_free(&preview);
   gtk_widget_destroy(dialog);
   
   return run;
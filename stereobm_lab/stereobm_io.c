@@ -0,0 +1,190 @@
+#include "stereobm_io.h"
+#include "stereobm_core.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <png.h>
+
+// Загрузка PNG через упрощенный API libpng
+static int load_png(const char *path, StereoBMImage *image) {
+  png_image png;
+  memset(&png, 0, sizeof(png));
+  png.version = PNG_IMAGE_VERSION;
+
+  if (!png_image_begin_read_from_file(&png, path)) {
+    fprintf(stderr, "%s: %s\n", path, png.message);
+    return -1;
+  }
+
+  int gray = (png.format & PNG_FORMAT_FLAG_COLOR) == 0;
+  png.format = gray ? PNG_FORMAT_GRAY : PNG_FORMAT_RGB;
+
+  image->width = png.width;
+  image->height = png.height;
+  image->channels = gray ? 1 : 3;
+  image->data = malloc(PNG_IMAGE_SIZE(png));
+  if (!image->data) {
+    fprintf(stderr, "%s: out of memory\n", path);
+    png_image_free(&png);
+    return -1;
+  }
+
+  if (!png_image_finish_read(&png, NULL, image->data, 0, NULL)) {
+    fprintf(stderr, "%s: %s\n", path, png.message);
+    stereobm_image_free(image);
+    return -1;
+  }
+  return 0;
+}
+
+// Очередное число заголовка PNM (с пропуском комментариев)
+static int pnm_read_int(FILE *f, int *value) {
+  int c = fgetc(f);
+  while (c != EOF && (isspace(c) || c == '#')) {
+    if (c == '#')
+      while (c != EOF && c != '\n')
+        c = fgetc(f);
+    c = fgetc(f);
+  }
+  if (c == EOF || !isdigit(c))
+    return -1;
+
+  *value = 0;
+  while (c != EOF && isdigit(c)) {
+    *value = *value * 10 + (c - '0');
+    c = fgetc(f);
+  }
+  return 0;
+}
+
+static int load_pnm(FILE *f, const char *path, StereoBMImage *image) {
+  char magic[2];
+  int width, height, maxval;
+
+  if (fread(magic, 1, 2, f) != 2 || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6') ||
+      pnm_read_int(f, &width) || pnm_read_int(f, &height) || pnm_read_int(f, &maxval) ||
+      width <= 0 || height <= 0 || maxval <= 0 || maxval > 255) {
+    fprintf(stderr, "%s: unsupported image format (expected PNG or 8-bit P5/P6)\n", path);
+    return -1;
+  }
+
+  image->width = width;
+  image->height = height;
+  image->channels = magic[1] == '5' ? 1 : 3;
+
+  size_t size = (size_t)width * height * image->channels;
+  image->data = malloc(size);
+  if (!image->data) {
+    fprintf(stderr, "%s: out of memory\n", path);
+    return -1;
+  }
+  if (fread(image->data, 1, size, f) != size) {
+    fprintf(stderr, "%s: truncated image data\n", path);
+    stereobm_image_free(image);
+    return -1;
+  }
+  return 0;
+}
+
+int stereobm_image_load(const char *path, StereoBMImage *image) {
+  unsigned char signature[8];
+
+  memset(image, 0, sizeof(*image));
+
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+
+  size_t n = fread(signature, 1, sizeof(signature), f);
+  int is_png = n == sizeof(signature) && !png_sig_cmp(signature, 0, sizeof(signature));
+  int result;
+
+  if (is_png) {
+    fclose(f);
+    return load_png(path, image);
+  }
+
+  rewind(f);
+  result = load_pnm(f, path, image);
+  fclose(f);
+  return result;
+}
+
+void stereobm_image_free(StereoBMImage *image) {
+  free(image->data);
+  image->data = NULL;
+}
+
+// 16-битный PGM (big-endian), значения диспаратности * 16
+static int write_pgm16(FILE *f, const int16_t *disparity_map, int width, int height) {
+  uint8_t *row = malloc((size_t)width * 2);
+  int result = row ? 0 : -1;
+
+  fprintf(f, "P5\n%d %d\n65535\n", width, height);
+  for (int i = 0; i < height && result == 0; i++) {
+    for (int j = 0; j < width; j++) {
+      int v = disparity_map[(size_t)i * width + j];
+      v = v < 0 ? 0 : v;
+      row[j * 2] = (uint8_t)(v >> 8);
+      row[j * 2 + 1] = (uint8_t)(v & 0xFF);
+    }
+    if (fwrite(row, 2, width, f) != (size_t)width)
+      result = -1;
+  }
+
+  free(row);
+  return result;
+}
+
+// PFM (little-endian, строки снизу вверх), диспаратность в пикселях;
+// ненайденные пиксели (0 в карте) записываются как +inf, как принято
+// для карт диспаратности в PFM
+static int write_pfm(FILE *f, const int16_t *disparity_map, int width, int height) {
+  float *row = malloc((size_t)width * sizeof(float));
+  int result = row ? 0 : -1;
+
+  fprintf(f, "Pf\n%d %d\n-1.0\n", width, height);
+  for (int i = height - 1; i >= 0 && result == 0; i--) {
+    for (int j = 0; j < width; j++) {
+      int16_t v = disparity_map[(size_t)i * width + j];
+      row[j] = v > 0 ? v / (float)STEREOBM_DISP_SCALE : INFINITY;
+    }
+    if (fwrite(row, sizeof(float), width, f) != (size_t)width)
+      result = -1;
+  }
+
+  free(row);
+  return result;
+}
+
+int stereobm_write_disparity(const char *path, const int16_t *disparity_map,
+                             int width, int height) {
+  const char *ext = strrchr(path, '.');
+  int result;
+
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+
+  if (ext && !strcasecmp(ext, ".pfm"))
+    result = write_pfm(f, disparity_map, width, height);
+  else
+    result = write_pgm16(f, disparity_map, width, height);
+
+  // Ошибка записи (например, нет места на диске) видна в ferror, а не только
+  // в fclose: буфер мог быть сброшен раньше
+  if (ferror(f))
+    result = -1;
+  if (fclose(f) != 0 || result != 0) {
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef STEREOBM_IO_H
+#define STEREOBM_IO_H
+
+// Чтение и запись изображений для stereobm-cli (PNG, PGM/PPM, PFM)
+
+#include <stdint.h>
+
+typedef struct {
+  int width;
+  int height;
+  int channels;    // 1 (градации серого) или 3 (RGB)
+  uint8_t *data;
+} StereoBMImage;
+
+// PNG или бинарный PGM/PPM (P5/P6, 8 бит). Возвращает 0 при успехе.
+int stereobm_image_load(const char *path, StereoBMImage *image);
+void stereobm_image_free(StereoBMImage *image);
+
+// Карта диспаратности (значения * 16): 16-битный PGM с исходными
+// значениями или PFM с диспаратностью в пикселях (+inf - не найдена).
+// Формат выбирается по расширению (.pfm, иначе PGM). Возвращает 0 при
+// успехе, -1 при ошибке открытия или записи (сообщение - в stderr).
+int stereobm_write_disparity(const char *path, const int16_t *disparity_map,
+                             int width, int height);
+
+#endif
@@ -1,6 +1,7 @@
 #include "stereobm.h"
 
 #define PLUG_IN_PROC   "plug-in-stereobm"
+#define PLUG_IN_BATCH_PROC "plug-in-stereobm-batch"
 #define PLUG_IN_ROLE   "stereobm"
 
 typedef struct _StereoBM  StereoBM;
@@ -32,6 +33,9 @@ static GimpValueArray * stereobm_run (GimpProcedure *procedure,
                                 GimpDrawable **drawables,
                                 GimpProcedureConfig *config,
                                 gpointer run_data);
+static GimpValueArray * stereobm_batch_run (GimpProcedure *procedure,
+                                GimpProcedureConfig *config,
+                                gpointer run_data);
 
                                 // Инициализация класса плагина
 static void stereobm_class_init (StereoBMClass *klass)
@@ -50,7 +54,114 @@ static void stereobm_init (StereoBM *stereobm)
 // Запрос списка процедур, предоставляемых плагином
 static GList * stereobm_query_procedures (GimpPlugIn *plug_in)
 {
-  return g_list_append (NULL, g_strdup (PLUG_IN_PROC));
+  GList *list = g_list_append (NULL, g_strdup (PLUG_IN_PROC));
+
+  return g_list_append (list, g_strdup (PLUG_IN_BATCH_PROC));
+}
+
+// Аргументы процедуры - поля StereoBMParams (диапазоны как в диалоге)
+static void stereobm_add_param_arguments (GimpProcedure *procedure)
+{
+  StereoBMParams defaults;
+  stereobm_params_init (&defaults);
+
+  gimp_procedure_add_int_argument (procedure, "num-disparities", "Num disparities",
+                                   "Number of disparity levels (multiple of 16)",
+                                   16, 256, defaults.num_disparities, G_PARAM_READWRITE);
+  gimp_procedure_add_int_argument (procedure, "min-disparity", "Min disparity",
+                                   "Smallest disparity searched (min + num <= 256)",
+                                   0, 240, defaults.min_disparity, G_PARAM_READWRITE);
+  gimp_procedure_add_boolean_argument (procedure, "auto-range", "Auto range",
+                                       "Narrow the range to the disparities found by a sparse search",
+                                       defaults.auto_range, G_PARAM_READWRITE);
+  gimp_procedure_add_int_argument (procedure, "block-size", "Block size",
+                                   "Matching window size (odd)",
+                                   3, 21, defaults.block_size, G_PARAM_READWRITE);
+  gimp_procedure_add_int_argument (procedure, "pre-filter-cap", "Pre filter cap",
+                                   "X-Sobel clipping value",
+                                   1, 63, defaults.pre_filter_cap, G_PARAM_READWRITE);
+  gimp_procedure_add_int_argument (procedure, "texture-threshold", "Texture threshold",
+                                   "Minimum window texture",
+                                   0, 1000, defaults.texture_threshold, G_PARAM_READWRITE);
+  gimp_procedure_add_int_argument (procedure, "uniqueness-ratio", "Uniqueness ratio",
+                                   "Uniqueness margin in percent",
+                                   0, 100, defaults.uniqueness_ratio, G_PARAM_READWRITE);
+  gimp_procedure_add_int_argument (procedure, "disp12-max-diff", "LR max difference",
+                                   "Left-right check: max disparity difference (-1 = off)",
+                                   -1, 256, defaults.disp12_max_diff, G_PARAM_READWRITE);
+  gimp_procedure_add_int_argument (procedure, "pyramid-levels", "Pyramid levels",
+                                   "Coarse-to-fine levels (0 = full search)",
+                                   0, 2, defaults.pyramid_levels, G_PARAM_READWRITE);
+  gimp_procedure_add_int_argument (procedure, "cost-type", "Matching cost",
+                                   "0 = SAD, 1 = Census 5x5, 2 = Census 7x9",
+                                   0, 2, defaults.cost_type, G_PARAM_READWRITE);
+  gimp_procedure_add_int_argument (procedure, "sgm-paths", "SGM paths",
+                                   "Semi-global matching paths (0 = block matching, 4 or 8)",
+                                   0, 8, defaults.sgm_paths, G_PARAM_READWRITE);
+  gimp_procedure_add_int_argument (procedure, "sgm-p1", "SGM P1",
+                                   "SGM penalty P1 per window pixel",
+                                   1, 64, defaults.sgm_p1, G_PARAM_READWRITE);
+  gimp_procedure_add_int_argument (procedure, "sgm-p2", "SGM P2",
+                                   "SGM penalty P2 per window pixel (at least P1)",
+                                   1, 256, defaults.sgm_p2, G_PARAM_READWRITE);
+  gimp_procedure_add_int_argument (procedure, "num-threads", "Threads",
+                                   "Worker threads (0 = number of processors)",
+                                   0, 256, defaults.num_threads, G_PARAM_READWRITE);
+}
+
+// Параметры из конфигурации процедуры; значения, которые диапазон аргумента
+// не ограничивает (четность, кратность 16, число путей), приводятся к
+// ближайшим допустимым
+static void stereobm_config_get (GimpProcedureConfig *config, StereoBMParams *params)
+{
+  gint cost_type;
+  gboolean auto_range;
+
+  g_object_get (config,
+                "num-disparities",   &params->num_disparities,
+                "min-disparity",     &params->min_disparity,
+                "auto-range",        &auto_range,
+                "block-size",        &params->block_size,
+                "pre-filter-cap",    &params->pre_filter_cap,
+                "texture-threshold", &params->texture_threshold,
+                "uniqueness-ratio",  &params->uniqueness_ratio,
+                "disp12-max-diff",   &params->disp12_max_diff,
+                "pyramid-levels",    &params->pyramid_levels,
+                "cost-type",         &cost_type,
+                "sgm-paths",         &params->sgm_paths,
+                "sgm-p1",            &params->sgm_p1,
+                "sgm-p2",            &params->sgm_p2,
+                "num-threads",       &params->num_threads,
+                NULL);
+
+  params->cost_type = cost_type;
+  params->num_disparities = params->num_disparities / 16 * 16;
+  params->min_disparity = MIN (params->min_disparity, 256 - params->num_disparities);
+  params->auto_range = auto_range;
+  params->block_size |= 1;
+  params->sgm_paths = params->sgm_paths >= 8 ? 8 : params->sgm_paths >= 4 ? 4 : 0;
+  params->sgm_p2 = MAX (params->sgm_p2, params->sgm_p1);
+}
+
+// Сохранение выбранных в диалоге значений (GIMP запоминает их как последние)
+static void stereobm_config_set (GimpProcedureConfig *config, const StereoBMParams *params)
+{
+  g_object_set (config,
+                "num-disparities",   params->num_disparities,
+                "min-disparity",     params->min_disparity,
+                "auto-range",        (gboolean) params->auto_range,
+                "block-size",        params->block_size,
+                "pre-filter-cap",    params->pre_filter_cap,
+                "texture-threshold", params->texture_threshold,
+                "uniqueness-ratio",  params->uniqueness_ratio,
+                "disp12-max-diff",   params->disp12_max_diff,
+                "pyramid-levels",    params->pyramid_levels,
+                "cost-type",         (gint) params->cost_type,
+                "sgm-paths",         params->sgm_paths,
+                "sgm-p1",            params->sgm_p1,
+                "sgm-p2",            params->sgm_p2,
+                "num-threads",       params->num_threads,
+                NULL);
 }
 
 // Создание процедуры плагина
@@ -83,6 +194,52 @@ static GimpProcedure * stereobm_create_procedure (GimpPlugIn  *plug_in,
         gimp_procedure_set_attribution (procedure, "Ogo",
                                         "Ogo, OGO project",
                                         "2025");
+
+        stereobm_add_param_arguments (procedure);
+        gimp_procedure_add_int_argument (procedure, "output", "Output",
+                                         "0 = color map, 1 = 8-bit gray (disparity in pixels), "
+                                         "2 = 16-bit gray (disparity * 16)",
+                                         STEREOBM_OUTPUT_COLOR, STEREOBM_OUTPUT_RAW16,
+                                         STEREOBM_OUTPUT_COLOR, G_PARAM_READWRITE);
+        gimp_procedure_add_image_return_value (procedure, "disparity-image", "Disparity image",
+                                               "New image with the disparity map",
+                                               FALSE, G_PARAM_READWRITE);
+    }
+  else if (!g_strcmp0 (name, PLUG_IN_BATCH_PROC))
+    {
+        // Пакетная обработка файлов без изображений GIMP (только PDB)
+        procedure = gimp_procedure_new (plug_in, name,
+                                        GIMP_PDB_PROC_TYPE_PLUGIN,
+                                        stereobm_batch_run, NULL, NULL);
+
+        gimp_procedure_set_documentation (procedure,
+                                        "Stereo Block Matching over a list of files",
+                                        "Computes disparity maps for side-by-side frames "
+                                        "(PNG or binary PGM/PPM) in parallel worker threads "
+                                        "and writes them to OUTPUT-DIR as 16-bit PGM "
+                                        "(disparity * 16) named <frame>_disp.pgm. "
+                                        "Frames whose names differ only by directory or "
+                                        "extension are failed after the first one. "
+                                        "num-threads is the number of frames processed at once.",
+                                        NULL);
+        gimp_procedure_set_attribution (procedure, "Ogo",
+                                        "Ogo, OGO project",
+                                        "2025");
+
+        gimp_procedure_add_string_array_argument (procedure, "input-files", "Input files",
+                                                  "Side-by-side stereo frames",
+                                                  G_PARAM_READWRITE);
+        gimp_procedure_add_string_argument (procedure, "output-dir", "Output directory",
+                                            "Directory for disparity maps (created if missing)",
+                                            NULL, G_PARAM_READWRITE);
+        stereobm_add_param_arguments (procedure);
+
+        gimp_procedure_add_int_return_value (procedure, "num-processed", "Processed",
+                                             "Number of frames written",
+                                             0, G_MAXINT, 0, G_PARAM_READWRITE);
+        gimp_procedure_add_int_return_value (procedure, "num-failed", "Failed",
+                                             "Number of frames that could not be processed",
+                                             0, G_MAXINT, 0, G_PARAM_READWRITE);
     }
 
   return procedure;
@@ -98,21 +255,9 @@ static GimpValueArray * stereobm_run (GimpProcedure *procedure,
 {
   GimpPDBStatusType status = GIMP_PDB_SUCCESS;
   GError *error = NULL;
-
-  // Проверяем режим выполнения - поддержка только интерактивного
-  if (run_mode != GIMP_RUN_INTERACTIVE) {
-    g_set_error(&error, GIMP_PLUG_IN_ERROR, 0,
-                "This plugin only supports interactive mode");
-    status = GIMP_PDB_CALLING_ERROR;
-    return gimp_procedure_new_return_values(procedure, status, error);
-  }
-    
-  // Инициализация UI
-  gimp_ui_init("stereobm");
-
   GimpDrawable *drawable;
     
-  gint n_drawables = g_list_length((GList *)drawables);
+  gint n_drawables = gimp_core_object_array_get_length((GObject **)drawables);
   if (n_drawables != 1) {
     g_set_error(&error, GIMP_PLUG_IN_ERROR, 0,
                 "Procedure requires exactly one drawable");
@@ -121,21 +266,79 @@ static GimpValueArray * stereobm_run (GimpProcedure *procedure,
   }
   drawable = drawables[0];
 
-  gimp_progress_init("Computing Stereo BM");
+  // Параметры: аргументы процедуры (при WITH_LAST_VALS и в интерактивном
+  // режиме GIMP заполняет конфигурацию последними значениями)
+  StereoBMParams params;
+  gint output;
+  stereobm_params_init(&params);
+  stereobm_config_get(config, &params);
+  g_object_get(config, "output", &output, NULL);
+
+  if (run_mode == GIMP_RUN_INTERACTIVE) {
+    // Инициализация UI
+    gimp_ui_init("stereobm");
+
+    // Отображение диалога параметров
+    StereoBMOutput dialog_output = output;
+    if (!stereobm_dialog(drawable, &params, &dialog_output)) {
+      gimp_message("Stereo BM: Operation cancelled by user");
+      return gimp_procedure_new_return_values(procedure, GIMP_PDB_CANCEL, NULL);
+    }
+    output = dialog_output;
+    stereobm_config_set(config, &params);
+    g_object_set(config, "output", output, NULL);
+  }
 
-  StereoBMParams params = {64, 15, 31, 10, 15};
+  // Вычисление карты диспаратности
+  GimpImage *disparity_image = stereobm_plugin(procedure, drawable, &params, output, run_mode,
+                                               &error);
+  if (!disparity_image)
+    return gimp_procedure_new_return_values(procedure, GIMP_PDB_EXECUTION_ERROR, error);
 
-  // Отображение диалога параметров
-  if (stereobm_dialog(&params)) {
-    // Вычисление карты диспаратности
-    stereobm_plugin(procedure, drawable, &params);
+  if (run_mode == GIMP_RUN_INTERACTIVE)
     gimp_message("Stereo BM: Successfully computed disparity map");
-  } else {
-    status = GIMP_PDB_CANCEL;
-    gimp_message("Stereo BM: Operation cancelled by user");
+
+  GimpValueArray *return_values = gimp_procedure_new_return_values(procedure, status, NULL);
+  GIMP_VALUES_SET_IMAGE(return_values, 1, disparity_image);
+  return return_values;
+}
+
+// Пакетная процедура: параметры только из аргументов
+static GimpValueArray * stereobm_batch_run (GimpProcedure *procedure,
+                                            GimpProcedureConfig *config,
+                                            gpointer run_data)
+{
+  GError *error = NULL;
+  gchar **input_files = NULL;
+  gchar *output_dir = NULL;
+  StereoBMParams params;
+
+  stereobm_params_init(&params);
+  stereobm_config_get(config, &params);
+  g_object_get(config,
+               "input-files", &input_files,
+               "output-dir",  &output_dir,
+               NULL);
+
+  if (!output_dir || !*output_dir || g_mkdir_with_parents(output_dir, 0755) != 0) {
+    g_set_error(&error, GIMP_PLUG_IN_ERROR, 0,
+                "Cannot create output directory '%s'", output_dir ? output_dir : "");
+    g_strfreev(input_files);
+    g_free(output_dir);
+    return gimp_procedure_new_return_values(procedure, GIMP_PDB_CALLING_ERROR, error);
   }
 
-  return gimp_procedure_new_return_values(procedure, status, error);
+  gint failed = 0;
+  gint processed = stereobm_batch((const gchar *const *)input_files, output_dir, &params, &failed);
+
+  g_strfreev(input_files);
+  g_free(output_dir);
+
+  GimpValueArray *return_values = gimp_procedure_new_return_values(procedure,
+                                                                   GIMP_PDB_SUCCESS, NULL);
+  GIMP_VALUES_SET_INT(return_values, 1, processed);
+  GIMP_VALUES_SET_INT(return_values, 2, failed);
+  return return_values;
 }
 
 GIMP_MAIN (STEREOBM_TYPE)
\ No newline at end of file
@@ -1,85 +1,463 @@
 #include "stereobm.h"
+#include <stdlib.h>
 
-// Основная функция обработки изображения
-void stereobm_plugin(GimpProcedure *procedure, GimpDrawable *drawable, 
-                    StereoBMParams *params) {
+// Размер RGB-полосы исходного изображения, байт. Память плагина
+// пропорциональна высоте полосы, а не размеру изображения.
+#define STEREOBM_BAND_BYTES (16 << 20)
+
+// Положение текущей полосы для общего прогресса
+typedef struct {
+  gint y_begin;
+  gint y_end;
+  gint height;
+} StereoBMBandProgress;
+
+// Прогресс вычислений libstereobm по полосе передается в GIMP
+static void stereobm_plugin_progress(double fraction, void *user_data) {
+  StereoBMBandProgress *band = user_data;
+
+  gimp_progress_update((band->y_begin + fraction * (band->y_end - band->y_begin)) / band->height);
+}
+
+// Сводка замеров: время стадий и счетчики поиска одной строкой
+static gchar *stereobm_stats_summary(const StereoBMStats *stats) {
+  GString *text = g_string_new(NULL);
+  gdouble total = 0.0;
+
+  for (gint i = 0; i < STEREOBM_NUM_STAGES; i++)
+    if (i != STEREOBM_STAGE_TEXTURE)
+      total += stats->seconds[i];
+
+  g_string_append_printf(text, "Disparity map computed in %.2f s:", total);
+  for (gint i = 0; i < STEREOBM_NUM_STAGES; i++) {
+    if (stats->seconds[i] > 0.0)
+      g_string_append_printf(text, " %s %.3f%s", stereobm_stage_name(i), stats->seconds[i],
+                             i == STEREOBM_STAGE_TEXTURE ? " (in threads)" : "");
+  }
+  g_string_append_printf(text, ". %lld of %lld pixels skipped by the texture threshold, "
+                         "%lld candidates evaluated",
+                         stats->texture_skipped, stats->pixels, stats->candidates);
+  if (stats->lr_rejected > 0)
+    g_string_append_printf(text, ", %lld rejected by the left-right check",
+                           stats->lr_rejected);
+  g_string_append_c(text, '.');
+  return g_string_free(text, FALSE);
+}
+
+// Область вычисления: выделение (без него - весь слой) в координатах левого
+// вида и столбцы, которые для нее читаются из каждого вида
+typedef struct {
+  gint x;                  // область карты
+  gint y;
+  gint width;
+  gint height;
+  gint crop_x;             // столбцы [crop_x, crop_x + crop_width) обоих видов
+  gint crop_width;
+} StereoBMRegion;
+
+// Выделение на правом виде переносится на левый, выделение на обоих видах
+// обрезается по левому. Слева область дополняется окном, фильтром Собеля и
+// диапазоном диспаратностей (правый вид), справа - окном и фильтром, с
+// LR-проверкой - и диапазоном (кандидаты правого вида). С пирамидой окно -
+// поле stereobm_column_margin() ее уровней, а левый край выравнивается по
+// масштабу грубого уровня: столбцы уменьшенных пар те же, что у всего
+// изображения. FALSE - выделение не задевает левый вид.
+static gboolean stereobm_plugin_region(GimpDrawable *drawable, const StereoBMParams *params,
+                                       gint stereo_width, StereoBMRegion *region) {
+  gint x, y, width, height;
+
+  if (!gimp_drawable_mask_intersect(drawable, &x, &y, &width, &height))
+    return FALSE;
+  if (x >= stereo_width)
+    x -= stereo_width;
+  width = MIN(x + width, stereo_width) - x;
+  if (width <= 0 || height <= 0)
+    return FALSE;
+
+  gint margin = stereobm_column_margin(params) + 1;
+  gint max_disparity = params->min_disparity + params->num_disparities - 1;
+  gint right_margin = margin + (params->disp12_max_diff >= 0 ? max_disparity : 0);
+
+  region->x = x;
+  region->y = y;
+  region->width = width;
+  region->height = height;
+  region->crop_x = MAX(0, x - margin - max_disparity) & ~((1 << params->pyramid_levels) - 1);
+  region->crop_width = MIN(stereo_width, x + width + right_margin) - region->crop_x;
+  return TRUE;
+}
+
+// Строки [y_begin, y_end) столбцов области обоих видов; в source_band они
+// лежат как side-by-side изображение шириной 2 * crop_width (RGB)
+static void stereobm_plugin_read(GeglBuffer *buffer, const StereoBMRegion *region,
+                                 gint stereo_width, gint y_begin, gint y_end,
+                                 guchar *source_band) {
+  gint rowstride = region->crop_width * 2 * 3;
+
+  gegl_buffer_get(buffer, GEGL_RECTANGLE(region->crop_x, y_begin, region->crop_width,
+                                         y_end - y_begin),
+                  1.0, babl_format("R'G'B' u8"), source_band, rowstride, GEGL_ABYSS_NONE);
+  gegl_buffer_get(buffer, GEGL_RECTANGLE(stereo_width + region->crop_x, y_begin,
+                                         region->crop_width, y_end - y_begin),
+                  1.0, babl_format("R'G'B' u8"), source_band + region->crop_width * 3,
+                  rowstride, GEGL_ABYSS_NONE);
+}
+
+// Диапазон диспаратностей столбцов области в rows строках карты шириной crop_width
+static void stereobm_plugin_region_minmax(const gint16 *disparity, const StereoBMRegion *region,
+                                          gint rows, gint *min_disp, gint *max_disp) {
+  for (gint r = 0; r < rows; r++)
+    stereobm_disparity_minmax(disparity + (gsize)r * region->crop_width, region->width,
+                              min_disp, max_disp);
+}
+
+// Автоматический диапазон оценивается один раз по всей области, как в
+// stereobm-cli, и полосы ищутся в нем с auto_range = 0 (оценка по каждой
+// полосе дала бы полосам разные диапазоны). Узлам сетки нужны только строки
+// их окон: окна уже шага сетки читаются по одному, перекрывающиеся - полосами
+// по band_height строк. Буферы - полос поиска. FALSE - нехватка памяти в
+// libstereobm.
+static gboolean stereobm_plugin_range(GeglBuffer *buffer, guchar *source_band,
+                                      guchar *left_filtered, guchar *right_filtered,
+                                      gint stereo_width, gint height, gint band_height,
+                                      const StereoBMRegion *region, const StereoBMParams *params,
+                                      StereoBMParams *estimated, StereoBMStats *stats) {
+  gint crop_width = region->crop_width;
+  gint half_block = params->block_size / 2;
+  gint region_end = region->y + region->height;
+  gboolean sparse = params->block_size < STEREOBM_RANGE_GRID;
+  gint step = sparse ? STEREOBM_RANGE_GRID : band_height;
+  gint rows = sparse ? 1 : band_height;
+  gint *histogram = g_new0(gint, params->min_disparity + params->num_disparities);
+  gint samples = 0;
+  gboolean filtered = TRUE;
+  gdouble stage_start = stereobm_time_now();
+
+  for (gint y_begin = stereobm_range_grid_row(params, region->y);
+       y_begin < region_end && filtered; y_begin += step) {
+    gint y_end = MIN(y_begin + rows, region_end);
+    gint filtered_begin = MAX(0, y_begin - half_block);
+    gint filtered_end = MIN(height, y_end + half_block);
+    gint source_begin = MAX(0, filtered_begin - 1);
+    gint source_end = MIN(height, filtered_end + 1);
+
+    stereobm_plugin_read(buffer, region, stereo_width, source_begin, source_end, source_band);
+    stereobm_stats_stage(stats, STEREOBM_STAGE_READ, &stage_start);
+    filtered =
+      stereobm_prefilter_view_rows(source_band, (gsize)crop_width * 2 * 3, crop_width, height, 3,
+                                   params->pre_filter_cap, source_begin, filtered_begin,
+                                   filtered_end, left_filtered) == 0 &&
+      stereobm_prefilter_view_rows(source_band + crop_width * 3, (gsize)crop_width * 2 * 3,
+                                   crop_width, height, 3, params->pre_filter_cap, source_begin,
+                                   filtered_begin, filtered_end, right_filtered) == 0;
+    stereobm_stats_stage(stats, STEREOBM_STAGE_PREFILTER, &stage_start);
+    if (filtered)
+      samples += stereobm_range_sample(left_filtered, right_filtered, crop_width, height,
+                                       filtered_begin, y_begin, y_end, params, histogram);
+    stereobm_stats_stage(stats, STEREOBM_STAGE_RANGE, &stage_start);
+  }
+
+  stereobm_range_finish(histogram, samples, params, estimated);
+  g_free(histogram);
+  return filtered;
+}
+
+// SGM: пути проходят через все строки, поэтому отфильтрованные изображения
+// области (со строками окна сверху и снизу) собираются целиком, по байту на
+// пиксель вида; исходное RGB по-прежнему читается полосами в source_band (не
+// меньше band_height + 2 строк). Пути начинаются на границах области.
+// Результат записывается в disparity_buffer, диапазон (если min_disp не NULL) -
+// отдельным проходом по карте. FALSE - нехватка памяти в libstereobm.
+static gboolean stereobm_plugin_sgm(GeglBuffer *buffer, GeglBuffer *disparity_buffer,
+                                guchar *source_band, gint stereo_width, gint height,
+                                gint band_height, const StereoBMRegion *region,
+                                const StereoBMParams *params, gint *min_disp, gint *max_disp,
+                                StereoBMStats *stats) {
+  gint crop_width = region->crop_width;
+  gint margin = stereobm_band_margin(params);
+  gint first = MAX(0, region->y - margin);
+  gint last = MIN(height, region->y + region->height + margin);
+  gint rows = last - first;
+  gdouble stage_start = stereobm_time_now();
+  guchar *left_filtered = g_new(guchar, (gsize)crop_width * rows);
+  guchar *right_filtered = g_new(guchar, (gsize)crop_width * rows);
+  gboolean filtered = TRUE;
+
+  for (gint y_begin = first; y_begin < last && filtered; y_begin += band_height) {
+    gint y_end = MIN(y_begin + band_height, last);
+    gint source_begin = MAX(0, y_begin - 1);
+    gint source_end = MIN(height, y_end + 1);
+
+    stereobm_plugin_read(buffer, region, stereo_width, source_begin, source_end, source_band);
+    stereobm_stats_stage(stats, STEREOBM_STAGE_READ, &stage_start);
+    filtered =
+      stereobm_prefilter_view_rows(source_band, (gsize)crop_width * 2 * 3, crop_width, height, 3,
+                                   params->pre_filter_cap, source_begin, y_begin, y_end,
+                                   left_filtered + (gsize)(y_begin - first) * crop_width) == 0 &&
+      stereobm_prefilter_view_rows(source_band + crop_width * 3, (gsize)crop_width * 2 * 3,
+                                   crop_width, height, 3, params->pre_filter_cap, source_begin,
+                                   y_begin, y_end,
+                                   right_filtered + (gsize)(y_begin - first) * crop_width) == 0;
+    stereobm_stats_stage(stats, STEREOBM_STAGE_PREFILTER, &stage_start);
+  }
+
+  StereoBMBandProgress whole = { 0, rows, rows };
+  gint16 *disparity_map = NULL;
+  if (filtered)
+    disparity_map = stereobm_compute_sgm(left_filtered, right_filtered, crop_width, rows,
+                                         params, stats, stereobm_plugin_progress, &whole);
+  g_free(left_filtered);
+  g_free(right_filtered);
+  if (!disparity_map)
+    return FALSE;
+
+  // Область внутри вычисленной карты
+  const gint16 *roi = disparity_map + (gsize)(region->y - first) * crop_width +
+                      (region->x - region->crop_x);
+
+  stage_start = stereobm_time_now();
+  if (min_disp)
+    stereobm_plugin_region_minmax(roi, region, region->height, min_disp, max_disp);
+  stereobm_stats_stage(stats, STEREOBM_STAGE_COLORIZE, &stage_start);
+  gegl_buffer_set(disparity_buffer, GEGL_RECTANGLE(0, 0, region->width, region->height),
+                  0, babl_format("Y u16"), roi, crop_width * sizeof(gint16));
+  stereobm_stats_stage(stats, STEREOBM_STAGE_WRITE, &stage_start);
+  free(disparity_map);
+  return TRUE;
+}
+
+// Основная функция обработки изображения. Возвращает новое изображение с
+// картой (окно создается только в интерактивном режиме) или NULL с error,
+// если изображение не side-by-side, выделение не задевает левый вид или
+// libstereobm не хватило памяти.
+// Карта считается только в области выделения: изображение результата
+// размером с вид, слой карты - размером с область и смещен на ее положение.
+GimpImage *stereobm_plugin(GimpProcedure *procedure, GimpDrawable *drawable,
+                           const StereoBMParams *params, StereoBMOutput output,
+                           GimpRunMode run_mode, GError **error) {
   gint width = gimp_drawable_get_width(drawable);
   gint height = gimp_drawable_get_height(drawable);
-  
+
   // Проверка, что изображение side-by-side
   if (width % 2 != 0) {
-    gimp_message("Изображение должно быть side-by-side (четная ширина)");
-    return;
+    g_set_error(error, GIMP_PLUG_IN_ERROR, 0, "Image must be side-by-side (even width)");
+    return NULL;
   }
-  
+
   gint stereo_width = width / 2;
-  
-  // Выделение память для изображений
-  guchar *original_image = g_new(guchar, width * height * 3); // RGB
-  guchar *left_image = g_new(guchar, stereo_width * height);
-  guchar *right_image = g_new(guchar, stereo_width * height);
-  guchar *output_image = g_new0(guchar, stereo_width * height * 3);
-  
-  // Получение изображения (RGB)
+  StereoBMRegion region;
+
+  if (!stereobm_plugin_region(drawable, params, stereo_width, &region)) {
+    g_set_error(error, GIMP_PLUG_IN_ERROR, 0, "Selection does not cover the left view");
+    return NULL;
+  }
+
+  gint crop_width = region.crop_width;
+  gint margin = stereobm_band_margin(params);
+
+  // Полоса результата и перекрытие: margin строк для окна (и окна census)
+  // и еще одна строка для фильтра Собеля с каждой стороны
+  gint band_height = CLAMP(STEREOBM_BAND_BYTES / (crop_width * 2 * 3), 16, MAX(region.height, 1));
+  gint max_source_rows = band_height + 2 * (margin + 1);
+  gint max_filtered_rows = band_height + 2 * margin;
+
   GeglBuffer *buffer = gimp_drawable_get_buffer(drawable);
-  gegl_buffer_get(buffer, NULL, 1.0, babl_format("R'G'B' u8"), original_image,
-                  GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
-  
-  // Разделяем side-by-side изображение на левое и правое
-  for (gint i = 0; i < height; i++) {
-    for (gint j = 0; j < stereo_width; j++) {
-      gint left_idx = (i * width + j) * 3;
-      gint right_idx = (i * width + j + stereo_width) * 3;
-      
-      // Формула для конвертации RGB в grayscale: 0.299*R + 0.587*G + 0.114*B
-      left_image[i * stereo_width + j] = (guchar)(
-        0.299 * original_image[left_idx] + 
-        0.587 * original_image[left_idx + 1] + 
-        0.114 * original_image[left_idx + 2]);
-      
-      right_image[i * stereo_width + j] = (guchar)(
-        0.299 * original_image[right_idx] + 
-        0.587 * original_image[right_idx + 1] + 
-        0.114 * original_image[right_idx + 2]);
+
+  // Карта диспаратности области до нормализации: буфер GEGL хранится
+  // плитками и при нехватке памяти вытесняется в swap
+  GeglBuffer *disparity_buffer = gegl_buffer_new(GEGL_RECTANGLE(0, 0, region.width, region.height),
+                                                 babl_format("Y u16"));
+  // Диапазон нужен только для цветовой шкалы; при поиске он накапливается
+  // по всем столбцам, поэтому с полями области считается по ее столбцам
+  gint min_disp = G_MAXINT;
+  gint max_disp = 0;
+  gint *range_min = output == STEREOBM_OUTPUT_COLOR ? &min_disp : NULL;
+  gint *range_max = output == STEREOBM_OUTPUT_COLOR ? &max_disp : NULL;
+  gboolean cropped = crop_width != region.width;
+  // Замеры стадий: чтение, фильтр и запись - здесь, поиск - в libstereobm
+  StereoBMStats stats = { { 0 } };
+  gdouble stage_start;
+
+  gimp_progress_init("Computing disparity map...");
+
+  // Выделение память для полос
+  guchar *source_band = g_new(guchar, (gsize)crop_width * 2 * 3 * max_source_rows); // RGB
+  guchar *left_filtered = g_new(guchar, (gsize)crop_width * max_filtered_rows);
+  guchar *right_filtered = g_new(guchar, (gsize)crop_width * max_filtered_rows);
+  gint16 *disparity_band = g_new(gint16, (gsize)crop_width * band_height);
+  // Нехватка памяти в libstereobm (ее буферы выделяются не через GLib)
+  gboolean computed = TRUE;
+
+  if (params->sgm_paths > 0) {
+    computed = stereobm_plugin_sgm(buffer, disparity_buffer, source_band, stereo_width, height,
+                                   band_height, &region, params, range_min, range_max, &stats);
+  } else {
+    gint region_end = region.y + region.height;
+    // Буферы потоков и census-дескрипторы выделяются один раз на все полосы
+    StereoBMContext *context = stereobm_context_new();
+    StereoBMParams ranged = *params;
+
+    computed = context != NULL;
+    if (computed && params->auto_range)
+      computed = stereobm_plugin_range(buffer, source_band, left_filtered, right_filtered,
+                                       stereo_width, height, band_height, &region, params,
+                                       &ranged, &stats);
+
+    // Вычисление карты диспаратности по полосам
+    for (gint y_begin = region.y; y_begin < region_end && computed; y_begin += band_height) {
+      gint y_end = MIN(y_begin + band_height, region_end);
+      gint source_begin = MAX(0, y_begin - margin - 1);
+      gint source_end = MIN(height, y_end + margin + 1);
+      gint filtered_begin = MAX(0, y_begin - margin);
+      gint filtered_end = MIN(height, y_end + margin);
+
+      // Получение полосы области обоих видов (RGB)
+      stage_start = stereobm_time_now();
+      stereobm_plugin_read(buffer, &region, stereo_width, source_begin, source_end, source_band);
+      stereobm_stats_stage(&stats, STEREOBM_STAGE_READ, &stage_start);
+
+      // Разделение side-by-side, градации серого и фильтр Собеля за один проход
+      if (stereobm_prefilter_view_rows(source_band, (gsize)crop_width * 2 * 3, crop_width,
+                                       height, 3, params->pre_filter_cap, source_begin,
+                                       filtered_begin, filtered_end, left_filtered) ||
+          stereobm_prefilter_view_rows(source_band + crop_width * 3, (gsize)crop_width * 2 * 3,
+                                       crop_width, height, 3, params->pre_filter_cap,
+                                       source_begin, filtered_begin, filtered_end,
+                                       right_filtered)) {
+        computed = FALSE;
+        break;
+      }
+      stereobm_stats_stage(&stats, STEREOBM_STAGE_PREFILTER, &stage_start);
+
+      // Диапазон для нормализации накапливается по всем полосам при поиске
+      StereoBMBandProgress band = { y_begin - region.y, y_end - region.y, region.height };
+      if (stereobm_context_compute_band(context, left_filtered, right_filtered, crop_width,
+                                        height, filtered_begin, y_begin, y_end, &ranged,
+                                        disparity_band, cropped ? NULL : range_min,
+                                        cropped ? NULL : range_max, &stats,
+                                        stereobm_plugin_progress, &band)) {
+        computed = FALSE;
+        break;
+      }
+
+      const gint16 *roi_band = disparity_band + (region.x - region.crop_x);
+      stage_start = stereobm_time_now();
+      if (cropped && range_min) {
+        stereobm_plugin_region_minmax(roi_band, &region, y_end - y_begin, range_min, range_max);
+        stereobm_stats_stage(&stats, STEREOBM_STAGE_COLORIZE, &stage_start);
+      }
+
+      // Диспаратность неотрицательна, поэтому int16 хранится как "Y u16" без копирования
+      gegl_buffer_set(disparity_buffer,
+                      GEGL_RECTANGLE(0, y_begin - region.y, region.width, y_end - y_begin),
+                      0, babl_format("Y u16"), roi_band, crop_width * sizeof(gint16));
+      stereobm_stats_stage(&stats, STEREOBM_STAGE_WRITE, &stage_start);
     }
+    stereobm_context_free(context);
   }
 
-  gimp_progress_init("Computing disparity map...");
-  
-  // Вычисление карты диспаратности
-  gint *disparity_map = stereobm_compute(left_image, right_image, stereo_width, height, params);
-
-  // Нормализация для отображения
-  normalize_disparity_map_color(disparity_map, output_image, stereo_width, height, 
-                         params->num_disparities);
-
-  // Создаем новое изображение для результата
-  GimpImage *new_image = gimp_image_new(stereo_width, height, GIMP_RGB);
-  GimpLayer *new_layer = gimp_layer_new(new_image, "Disparity Map", 
-                                       stereo_width, height, GIMP_RGB_IMAGE,
+  g_free(source_band);
+  g_free(left_filtered);
+  g_free(right_filtered);
+
+  if (!computed) {
+    g_free(disparity_band);
+    g_object_unref(buffer);
+    g_object_unref(disparity_buffer);
+    g_set_error(error, GIMP_PLUG_IN_ERROR, 0, "Not enough memory to compute the disparity map");
+    return NULL;
+  }
+
+  // Создаем новое изображение для результата: RGB для цветовой шкалы,
+  // иначе серое нужной точности (значения пишутся в формате слоя как есть)
+  GimpImage *new_image;
+  GimpImageType layer_type = GIMP_RGB_IMAGE;
+
+  if (output == STEREOBM_OUTPUT_COLOR) {
+    new_image = gimp_image_new(stereo_width, height, GIMP_RGB);
+  } else {
+    new_image = gimp_image_new_with_precision(stereo_width, height, GIMP_GRAY,
+                                              output == STEREOBM_OUTPUT_RAW16 ?
+                                              GIMP_PRECISION_U16_LINEAR :
+                                              GIMP_PRECISION_U8_NON_LINEAR);
+    layer_type = GIMP_GRAY_IMAGE;
+  }
+  GimpLayer *new_layer = gimp_layer_new(new_image, "Disparity Map",
+                                       region.width, region.height, layer_type,
                                        100, GIMP_LAYER_MODE_NORMAL);
-  
+
   gimp_image_insert_layer(new_image, new_layer, NULL, 0);
-  
- // Записываем результат
+  gimp_layer_set_offsets(new_layer, region.x, region.y);
+
   GeglBuffer *output_buffer = gimp_drawable_get_buffer(GIMP_DRAWABLE(new_layer));
-  gegl_buffer_set(output_buffer, NULL, 0, babl_format("R'G'B' u8"), output_image,
-                  GEGL_AUTO_ROWSTRIDE);
-  
-  gimp_drawable_update(GIMP_DRAWABLE(new_layer), 0, 0, stereo_width, height);
-  
+  guchar *output_band = NULL;
+
+  // Перенос карты в слой (для цвета и 8 бит - по полосам) - стадия write,
+  // пересчет значений - colorize
+  stage_start = stereobm_time_now();
+
+  if (output == STEREOBM_OUTPUT_RAW16) {
+    // Формат карты совпадает с форматом слоя ("Y u16")
+    gegl_buffer_copy(disparity_buffer, NULL, GEGL_ABYSS_NONE, output_buffer, NULL);
+    stereobm_stats_stage(&stats, STEREOBM_STAGE_WRITE, &stage_start);
+  } else {
+    // Таблица цветов строится один раз на весь диапазон
+    StereoBMColormap *colormap = NULL;
+    if (output == STEREOBM_OUTPUT_COLOR) {
+      colormap = g_new(StereoBMColormap, 1);
+      stereobm_colormap_init(colormap, min_disp, max_disp,
+                             params->min_disparity + params->num_disparities);
+    }
+    output_band = g_new(guchar, (gsize)region.width * band_height * 3);
+    stereobm_stats_stage(&stats, STEREOBM_STAGE_COLORIZE, &stage_start);
+
+    // Нормализация для отображения и запись результата по полосам
+    for (gint y_begin = 0; y_begin < region.height; y_begin += band_height) {
+      gint y_end = MIN(y_begin + band_height, region.height);
+      gsize band_pixels = (gsize)region.width * (y_end - y_begin);
+      const GeglRectangle *rect = GEGL_RECTANGLE(0, y_begin, region.width, y_end - y_begin);
+
+      gegl_buffer_get(disparity_buffer, rect, 1.0, babl_format("Y u16"), disparity_band,
+                      GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+      stereobm_stats_stage(&stats, STEREOBM_STAGE_WRITE, &stage_start);
+
+      if (colormap) {
+        stereobm_colormap_apply(colormap, disparity_band, output_band, band_pixels);
+      } else {
+        // Диспаратность в пикселях (не больше 255) без дробных бит
+        for (gsize i = 0; i < band_pixels; i++)
+          output_band[i] = (guchar)(disparity_band[i] >> STEREOBM_DISP_SHIFT);
+      }
+      stereobm_stats_stage(&stats, STEREOBM_STAGE_COLORIZE, &stage_start);
+
+      gegl_buffer_set(output_buffer, rect, 0,
+                      babl_format(colormap ? "R'G'B' u8" : "Y' u8"), output_band,
+                      GEGL_AUTO_ROWSTRIDE);
+      stereobm_stats_stage(&stats, STEREOBM_STAGE_WRITE, &stage_start);
+    }
+    g_free(colormap);
+  }
+
+  gimp_drawable_update(GIMP_DRAWABLE(new_layer), 0, 0, region.width, region.height);
+
   // Освобождаем память
-  g_free(original_image);
-  g_free(left_image);
-  g_free(right_image);
-  g_free(output_image);
-  g_free(disparity_map);
-  
+  g_free(output_band);
+  g_free(disparity_band);
+
   g_object_unref(buffer);
+  g_object_unref(disparity_buffer);
   g_object_unref(output_buffer);
-  
-  // Отображаем результат
-  gimp_display_new(new_image);
-  
-  gimp_message("Disparity map computed successfully!");
-}
\ No newline at end of file
+
+  // Отображаем результат; замеры - в сообщении или (без окон) в журнале
+  // отладки: G_MESSAGES_DEBUG=all
+  gchar *summary = stereobm_stats_summary(&stats);
+  if (run_mode == GIMP_RUN_INTERACTIVE) {
+    gimp_display_new(new_image);
+    gimp_message(summary);
+  } else {
+    g_debug("%s", summary);
+  }
+  g_free(summary);
+
+  return new_image;
+}
@@ -0,0 +1,472 @@
+#include "stereobm_core.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define STEREOBM_HAVE_X86 1
+#endif
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+// Semi-global matching: стоимость окна (SAD или census) для каждого (x, d)
+// агрегируется вдоль путей со штрафами P1 (изменение d на 1) и P2 (скачок):
+//   L(p, d) = C(p, d) + min(L(p-r, d), L(p-r, d±1) + P1, min_k L(p-r, k) + P2)
+//             - min_k L(p-r, k)
+// Все пути по строке считаются построчно, поэтому состояние путей занимает
+// O(width * nd). Сумма путей S хранится для всего изображения только если
+// width * height * nd укладывается в STEREOBM_SGM_VOLUME_BYTES: тогда второй
+// проход снизу вверх добавляет пути, идущие вверх. Иначе используется один
+// проход (3 из 4 или 5 из 8 путей, как MODE_SGBM в OpenCV).
+#ifndef STEREOBM_SGM_VOLUME_BYTES
+#define STEREOBM_SGM_VOLUME_BYTES ((size_t)256 << 20)
+#endif
+
+#define SGM_INF 0xFFFF
+
+// Стоимости строки окна: суммы столбцов окна сдвигаются по строкам в любом
+// направлении, затем горизонтальное окно (как в census-поиске stereobm_compute)
+typedef struct {
+  const uint8_t *left;
+  const uint8_t *right;
+  int width;
+  int height;
+  int half_block;
+  int min_disparity;
+  int num_disparities;
+  StereoBMCostType cost_type;
+  StereoBMCensusSlideFunc census_slide;
+  uint64_t *census;       // 4 строки дескрипторов: left/right добавляемой и вычитаемой
+  uint16_t *col_cost;     // width * nd
+  uint16_t *window;       // nd
+  uint16_t invalid_cost;  // стоимость вне изображения (максимум окна)
+} SGMCost;
+
+// Сдвиг сумм столбцов: добавление строки add_row и вычитание sub_row (< 0 - нет)
+static void sgm_cost_slide(SGMCost *c, int add_row, int sub_row) {
+  int width = c->width;
+
+  if (c->cost_type == STEREOBM_COST_SAD) {
+    stereobm_sad_slide(c->left + (size_t)add_row * width, c->right + (size_t)add_row * width,
+                       sub_row >= 0 ? c->left + (size_t)sub_row * width : NULL,
+                       sub_row >= 0 ? c->right + (size_t)sub_row * width : NULL,
+                       0, width, c->min_disparity, c->num_disparities, c->col_cost);
+    return;
+  }
+
+  uint64_t *la = c->census, *ra = la + width, *ls = ra + width, *rs = ls + width;
+  stereobm_census_rows(c->left, width, c->height, 0, add_row, add_row + 1, c->cost_type, la);
+  stereobm_census_rows(c->right, width, c->height, 0, add_row, add_row + 1, c->cost_type, ra);
+  if (sub_row >= 0) {
+    stereobm_census_rows(c->left, width, c->height, 0, sub_row, sub_row + 1, c->cost_type, ls);
+    stereobm_census_rows(c->right, width, c->height, 0, sub_row, sub_row + 1, c->cost_type, rs);
+  }
+  c->census_slide(la, ra, sub_row >= 0 ? ls : NULL, sub_row >= 0 ? rs : NULL,
+                  0, width, c->min_disparity, c->num_disparities, c->col_cost);
+}
+
+// Стоимости строки y (индекс k - диспаратность min_disparity + k); step - направление прохода (+1 вниз, -1 вверх),
+// ready - суммы столбцов уже соответствуют строке y - step
+static void sgm_cost_row(SGMCost *c, int y, int step, int ready, uint16_t *cost) {
+  int width = c->width, nd = c->num_disparities, hb = c->half_block;
+
+  if (y < hb || y >= c->height - hb) {
+    memset(cost, 0, (size_t)width * nd * sizeof(uint16_t));
+    return;
+  }
+
+  if (ready) {
+    sgm_cost_slide(c, step > 0 ? y + hb : y - hb, step > 0 ? y - hb - 1 : y + hb + 1);
+  } else {
+    memset(c->col_cost, 0, (size_t)width * nd * sizeof(uint16_t));
+    for (int r = y - hb; r <= y + hb; r++)
+      sgm_cost_slide(c, r, -1);
+  }
+  stereobm_census_box_row(c->col_cost, width, hb, nd, c->window, cost);
+
+  // Столбцы без окна и диспаратности, при которых окно выходит за левый край
+  for (int x = 0; x < width; x++) {
+    uint16_t *row = cost + (size_t)x * nd;
+    int d_valid = x < hb || x >= width - hb ? 0 : MAX(0, MIN(nd, x - hb + 1 - c->min_disparity));
+    for (int d = d_valid; d < nd; d++)
+      row[d] = c->invalid_cost;
+  }
+}
+
+// Шаг пути для одного пикселя: cur = cost + min(...) - prev_min, sum += cur
+// (с насыщением). prev и cur содержат ограничители SGM_INF в [-1] и [nd];
+// prev == NULL - начало пути. Возвращает min_d cur[d].
+static int sgm_step(const uint16_t *cost, const uint16_t *prev, int prev_min,
+                    int p1, int p2, int nd, uint16_t *cur, uint16_t *sum) {
+  int d = 0, cur_min = SGM_INF;
+
+  if (!prev) {
+    for (d = 0; d < nd; d++) {
+      cur[d] = cost[d];
+      cur_min = MIN(cur_min, cost[d]);
+      sum[d] = (uint16_t)MIN(sum[d] + cost[d], SGM_INF);
+    }
+    return cur_min;
+  }
+
+  int jump = MIN(prev_min + p2, SGM_INF);
+
+#ifdef STEREOBM_HAVE_X86
+  // SSE2, 8 диспаратностей: min для uint16 - a - subs(a, b), так как
+  // беззнакового _mm_min_epu16 в SSE2 нет
+#define SGM_MIN_EPU16(a, b) _mm_sub_epi16((a), _mm_subs_epu16((a), (b)))
+  const __m128i p1v = _mm_set1_epi16((short)p1);
+  const __m128i jumpv = _mm_set1_epi16((short)jump);
+  const __m128i prev_minv = _mm_set1_epi16((short)prev_min);
+  __m128i minv = _mm_set1_epi16((short)SGM_INF);
+
+  for (; d + 8 <= nd; d += 8) {
+    __m128i same = _mm_loadu_si128((const __m128i *)(prev + d));
+    __m128i lower = _mm_adds_epu16(_mm_loadu_si128((const __m128i *)(prev + d - 1)), p1v);
+    __m128i upper = _mm_adds_epu16(_mm_loadu_si128((const __m128i *)(prev + d + 1)), p1v);
+    __m128i m = SGM_MIN_EPU16(SGM_MIN_EPU16(same, lower), SGM_MIN_EPU16(upper, jumpv));
+    __m128i v = _mm_adds_epu16(_mm_loadu_si128((const __m128i *)(cost + d)),
+                               _mm_sub_epi16(m, prev_minv));
+
+    _mm_storeu_si128((__m128i *)(cur + d), v);
+    _mm_storeu_si128((__m128i *)(sum + d),
+                     _mm_adds_epu16(_mm_loadu_si128((const __m128i *)(sum + d)), v));
+    minv = SGM_MIN_EPU16(minv, v);
+  }
+
+  // Минимум по линиям
+  minv = SGM_MIN_EPU16(minv, _mm_srli_si128(minv, 8));
+  minv = SGM_MIN_EPU16(minv, _mm_srli_si128(minv, 4));
+  minv = SGM_MIN_EPU16(minv, _mm_srli_si128(minv, 2));
+  cur_min = _mm_cvtsi128_si32(minv) & 0xFFFF;
+#undef SGM_MIN_EPU16
+#endif
+
+  for (; d < nd; d++) {
+    int m = MIN(MIN(prev[d], prev[d - 1] + p1), MIN(prev[d + 1] + p1, jump));
+    int v = MIN(cost[d] + m - prev_min, SGM_INF);
+    cur[d] = (uint16_t)v;
+    sum[d] = (uint16_t)MIN(sum[d] + v, SGM_INF);
+    cur_min = MIN(cur_min, v);
+  }
+  return cur_min;
+}
+
+// Состояние путей, приходящих из предыдущей строки (dx = -1, 0, +1)
+typedef struct {
+  int dx;
+  uint16_t *prev;      // width * stride, ограничители в [0] и [nd + 1]
+  uint16_t *cur;
+  uint16_t *prev_min;  // width
+  uint16_t *cur_min;
+} SGMPath;
+
+// Строка путей с ограничителями SGM_INF вокруг каждого пикселя
+static void sgm_path_fill(uint16_t *rows, int width, int stride) {
+  for (size_t i = 0; i < (size_t)width * stride; i++)
+    rows[i] = SGM_INF;
+}
+
+// Буферы SGM в одном блоке (StereoBMArena): суммы столбцов и стоимости
+// строки, состояние путей и сумма путей. Проходы идут по очереди и делят
+// буферы строки.
+typedef struct {
+  uint64_t *census;            // SGMCost
+  uint16_t *col_cost;
+  uint16_t *window;
+  uint16_t *cost;              // стоимости строки, width * nd
+  uint16_t *right_cost;        // LR-проверка (NULL - выключена)
+  int16_t *right_disparity;
+  uint16_t *horizontal;        // 2 пикселя горизонтальных путей
+  uint16_t *path_rows[3][2];   // prev/cur путей из предыдущей строки
+  uint16_t *path_min[3][2];
+  uint16_t *sum;               // сумма путей: sum_rows строк width * nd
+  int sum_rows;                // height или 1
+} SGMBuffers;
+
+// Сумма путей хранится для всего изображения, если помещается в бюджет
+static int sgm_full_sum(int width, int height, int num_disparities) {
+  return (double)width * num_disparities * height * sizeof(uint16_t) <=
+         STEREOBM_SGM_VOLUME_BYTES;
+}
+
+static void sgm_layout(StereoBMArena *arena, SGMBuffers *b, int width, int height,
+                       const StereoBMParams *params, int full_sum) {
+  int nd = params->num_disparities;
+  size_t stride = nd + 2;
+  size_t row_size = (size_t)width * nd;
+  int num_dx = params->sgm_paths >= 8 ? 3 : 1;
+
+  b->census = params->cost_type != STEREOBM_COST_SAD ?
+              stereobm_arena_take(arena, 4 * (size_t)width * sizeof(uint64_t)) : NULL;
+  b->col_cost = stereobm_arena_take(arena, row_size * sizeof(uint16_t));
+  b->window = stereobm_arena_take(arena, nd * sizeof(uint16_t));
+  b->cost = stereobm_arena_take(arena, row_size * sizeof(uint16_t));
+  b->right_cost = NULL;
+  b->right_disparity = NULL;
+  if (params->disp12_max_diff >= 0) {
+    b->right_cost = stereobm_arena_take(arena, width * sizeof(uint16_t));
+    b->right_disparity = stereobm_arena_take(arena, width * sizeof(int16_t));
+  }
+  b->horizontal = stereobm_arena_take(arena, 2 * stride * sizeof(uint16_t));
+  for (int k = 0; k < num_dx; k++)
+    for (int i = 0; i < 2; i++) {
+      b->path_rows[k][i] = stereobm_arena_take(arena, width * stride * sizeof(uint16_t));
+      b->path_min[k][i] = stereobm_arena_take(arena, width * sizeof(uint16_t));
+    }
+  b->sum_rows = full_sum ? height : 1;
+  b->sum = stereobm_arena_take(arena, row_size * b->sum_rows * sizeof(uint16_t));
+}
+
+// Диспаратность строки по сумме путей: минимум по допустимому диапазону
+// и проверка уникальности без соседних d (как в StereoSGBM). С LR-проверкой
+// правый вид берется из той же суммы (right_* не NULL); возвращает число
+// отброшенных ею пикселей.
+static int sgm_select_row(const uint16_t *sum, int width, int height, int y, int half_block,
+                          const StereoBMParams *params, uint16_t *right_cost,
+                          int16_t *right_disparity, int16_t *disparity_row) {
+  int nd = params->num_disparities;
+  int min_d = params->min_disparity;
+  int rejected = 0;
+
+  if (right_disparity)
+    stereobm_right_disparity_row(sum, width, half_block, min_d, nd, right_cost, right_disparity);
+
+  for (int x = 0; x < width; x++) {
+    disparity_row[x] = 0;
+    if (y < half_block || y >= height - half_block || x < half_block || x >= width - half_block)
+      continue;
+
+    int d_begin = MAX(0, x - (width - half_block - 2) - min_d);
+    int d_end = MIN(nd, x - half_block + 1 - min_d);
+    const uint16_t *s = sum + (size_t)x * nd;
+    int best = INT_MAX, best_d = 0, second = INT_MAX;
+
+    for (int d = d_begin; d < d_end; d++)
+      if (s[d] < best) {
+        best = s[d];
+        best_d = d;
+      }
+    if (best == INT_MAX)
+      continue;
+    for (int d = d_begin; d < d_end; d++)
+      if ((d < best_d - 1 || d > best_d + 1) && s[d] < second)
+        second = s[d];
+
+    if (second != INT_MAX && second - best <= best * params->uniqueness_ratio / 100)
+      continue;
+
+    int d = best_d + min_d;
+    if (right_disparity) {
+      int rd = right_disparity[x - d];
+      if (rd < 0 || abs(d - rd) > params->disp12_max_diff) {
+        rejected++;
+        continue;
+      }
+    }
+    disparity_row[x] = (int16_t)(d * STEREOBM_DISP_SCALE);
+  }
+  return rejected;
+}
+
+// Один проход по строкам: step = +1 (сверху вниз, с горизонтальными путями)
+// или -1 (снизу вверх). Сумма путей b->sum - вся карта (stride строки
+// width * nd) или одна строка, если sum_rows == 1. Возвращает число пикселей,
+// отброшенных LR-проверкой.
+static long long sgm_pass(SGMCost *c, const StereoBMParams *params, int step, int num_dx,
+                     const SGMBuffers *b, int16_t *disparity_map,
+                     StereoBMProgressFunc progress, void *progress_data,
+                     double progress_begin, double progress_span) {
+  int width = c->width, height = c->height, nd = c->num_disparities;
+  int stride = nd + 2;
+  int window_area = params->block_size * params->block_size;
+  int p1 = MIN(params->sgm_p1 * window_area, SGM_INF);
+  int p2 = MIN(MAX(params->sgm_p2, params->sgm_p1) * window_area, SGM_INF);
+  size_t row_size = (size_t)width * nd;
+
+  uint16_t *cost = b->cost;
+  uint16_t *sum = b->sum;
+  int sum_rows = b->sum_rows;
+  uint16_t *right_cost = disparity_map ? b->right_cost : NULL;
+  int16_t *right_disparity = disparity_map ? b->right_disparity : NULL;
+  long long lr_rejected = 0;
+  uint16_t *horizontal = b->horizontal;
+  SGMPath paths[3];
+
+  sgm_path_fill(horizontal, 2, stride);
+  for (int k = 0; k < num_dx; k++) {
+    paths[k].dx = num_dx == 1 ? 0 : k - 1;
+    paths[k].prev = b->path_rows[k][0];
+    paths[k].cur = b->path_rows[k][1];
+    paths[k].prev_min = b->path_min[k][0];
+    paths[k].cur_min = b->path_min[k][1];
+    sgm_path_fill(paths[k].prev, width, stride);
+    sgm_path_fill(paths[k].cur, width, stride);
+  }
+
+  int y_first = step > 0 ? 0 : height - 1;
+  for (int n = 0; n < height; n++) {
+    int y = y_first + n * step;
+    uint16_t *sum_row = sum + (sum_rows == 1 ? 0 : (size_t)y * row_size);
+
+    sgm_cost_row(c, y, step, n > 0 && y - step >= c->half_block &&
+                 y - step < height - c->half_block, cost);
+    if (step > 0)
+      memset(sum_row, 0, row_size * sizeof(uint16_t));
+
+    // Пути из предыдущей строки прохода
+    for (int k = 0; k < num_dx; k++) {
+      SGMPath *path = &paths[k];
+      for (int x = 0; x < width; x++) {
+        int px = x - path->dx;
+        int start = n == 0 || px < 0 || px >= width;
+        path->cur_min[x] = (uint16_t)sgm_step(cost + (size_t)x * nd,
+                                              start ? NULL : path->prev + (size_t)px * stride + 1,
+                                              start ? 0 : path->prev_min[px], p1, p2, nd,
+                                              path->cur + (size_t)x * stride + 1,
+                                              sum_row + (size_t)x * nd);
+      }
+      uint16_t *t = path->prev; path->prev = path->cur; path->cur = t;
+      t = path->prev_min; path->prev_min = path->cur_min; path->cur_min = t;
+    }
+
+    // Горизонтальные пути (слева направо и справа налево) - в первом проходе
+    // (два буфера по очереди: текущий пиксель и предыдущий)
+    if (step > 0) {
+      int prev_min = 0;
+      for (int x = 0; x < width; x++)
+        prev_min = sgm_step(cost + (size_t)x * nd, x ? horizontal + (x + 1) % 2 * stride + 1 : NULL,
+                            prev_min, p1, p2, nd, horizontal + x % 2 * stride + 1,
+                            sum_row + (size_t)x * nd);
+      for (int x = width - 1; x >= 0; x--)
+        prev_min = sgm_step(cost + (size_t)x * nd,
+                            x < width - 1 ? horizontal + (x + 1) % 2 * stride + 1 : NULL,
+                            prev_min, p1, p2, nd, horizontal + x % 2 * stride + 1,
+                            sum_row + (size_t)x * nd);
+    }
+
+    // Выбор диспаратности, когда все пути строки сложены
+    if (disparity_map)
+      lr_rejected += sgm_select_row(sum_row, width, height, y, c->half_block, params,
+                                    right_cost, right_disparity,
+                                    disparity_map + (size_t)y * width);
+
+    if (progress && (n % 16 == 15 || n == height - 1))
+      progress(progress_begin + progress_span * (n + 1) / height, progress_data);
+  }
+
+  return lr_rejected;
+}
+
+// Поиск по уже размеченным буферам (диапазон params - окончательный)
+static void sgm_compute(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                        int width, int height, const StereoBMParams *params,
+                        const SGMBuffers *b, int16_t *disparity_map, StereoBMStats *stats,
+                        StereoBMProgressFunc progress, void *progress_data) {
+  double stage_start = stereobm_time_now();
+  int nd = params->num_disparities;
+  int num_dx = params->sgm_paths >= 8 ? 3 : 1;
+
+  SGMCost c;
+  c.left = left_filtered;
+  c.right = right_filtered;
+  c.width = width;
+  c.height = height;
+  c.half_block = params->block_size / 2;
+  c.min_disparity = params->min_disparity;
+  c.num_disparities = nd;
+  c.cost_type = params->cost_type;
+  c.census_slide = stereobm_select_census_func();
+  c.census = b->census;
+  c.col_cost = b->col_cost;
+  c.window = b->window;
+
+  int pixel_max = params->cost_type == STEREOBM_COST_CENSUS_7X9 ? 62 :
+                  params->cost_type == STEREOBM_COST_CENSUS_5X5 ? 24 : 2 * params->pre_filter_cap;
+  c.invalid_cost = (uint16_t)MIN(pixel_max * params->block_size * params->block_size, SGM_INF);
+
+  long long lr_rejected;
+  if (b->sum_rows > 1) {
+    sgm_pass(&c, params, 1, num_dx, b, NULL, progress, progress_data, 0.0, 0.5);
+    lr_rejected = sgm_pass(&c, params, -1, num_dx, b, disparity_map,
+                           progress, progress_data, 0.5, 0.5);
+  } else {
+    lr_rejected = sgm_pass(&c, params, 1, num_dx, b, disparity_map,
+                           progress, progress_data, 0.0, 1.0);
+  }
+
+  // Текстура не проверяется, стоимость считается для всего объема (x, d)
+  if (stats) {
+    stereobm_stats_stage(stats, STEREOBM_STAGE_MATCHING, &stage_start);
+    stats->pixels += (long long)width * height;
+    stats->candidates += (long long)width * height * nd;
+    stats->lr_rejected += lr_rejected;
+  }
+}
+
+size_t stereobm_sgm_work_size(int width, int height, const StereoBMParams *params) {
+  StereoBMArena layout = { NULL, 0 };
+  SGMBuffers b;
+
+  sgm_layout(&layout, &b, width, height, params,
+             sgm_full_sum(width, height, params->num_disparities));
+  return layout.size;
+}
+
+void stereobm_compute_sgm_work(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                               int width, int height, const StereoBMParams *params,
+                               void *work, int16_t *disparity_map, StereoBMStats *stats,
+                               StereoBMProgressFunc progress, void *progress_data) {
+  StereoBMArena layout = { work, 0 };
+  SGMBuffers b;
+
+  sgm_layout(&layout, &b, width, height, params,
+             sgm_full_sum(width, height, params->num_disparities));
+  sgm_compute(left_filtered, right_filtered, width, height, params, &b, disparity_map, stats,
+              progress, progress_data);
+}
+
+int16_t *stereobm_compute_sgm(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                              int width, int height, const StereoBMParams *params,
+                              StereoBMStats *stats,
+                              StereoBMProgressFunc progress, void *progress_data) {
+  StereoBMParams ranged;
+  double stage_start = stereobm_time_now();
+
+  // Автоматический диапазон: одна оценка по всему изображению
+  if (params->auto_range) {
+    stereobm_estimate_range(left_filtered, right_filtered, width, height, 0, 0, height,
+                            params, &ranged);
+    params = &ranged;
+    stereobm_stats_stage(stats, STEREOBM_STAGE_RANGE, &stage_start);
+  }
+
+  // Полная сумма путей, если помещается в бюджет и память под нее есть,
+  // иначе одна строка
+  int16_t *disparity_map = malloc((size_t)width * height * sizeof(int16_t));
+  int full_sum = sgm_full_sum(width, height, params->num_disparities);
+  StereoBMArena layout = { NULL, 0 };
+  SGMBuffers b;
+
+  sgm_layout(&layout, &b, width, height, params, full_sum);
+  void *work = stereobm_arena_alloc(layout.size);
+  if (!work && full_sum) {
+    layout = (StereoBMArena){ NULL, 0 };
+    sgm_layout(&layout, &b, width, height, params, full_sum = 0);
+    work = stereobm_arena_alloc(layout.size);
+  }
+  if (!disparity_map || !work) {
+    free(disparity_map);
+    free(work);
+    return NULL;
+  }
+
+  layout = (StereoBMArena){ work, 0 };
+  sgm_layout(&layout, &b, width, height, params, full_sum);
+  sgm_compute(left_filtered, right_filtered, width, height, params, &b, disparity_map, stats,
+              progress, progress_data);
+  free(work);
+  return disparity_map;
+}
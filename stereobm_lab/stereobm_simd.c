@@ -0,0 +1,374 @@
+#include "stereobm_core.h"
+#include <stdlib.h>
+#include <limits.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STEREOBM_HAVE_X86 1
+#endif
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define CLAMP(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
+
+// Учет очередного кандидата (или лучшего значения блока кандидатов).
+// При равной стоимости побеждает меньшая диспаратность, так что результат
+// не зависит от порядка обхода частей диапазона (см. match_hinted в compute.c)
+static inline void match_merge(StereoBMMatch *match, int cost,
+                               int second_cost, int d) {
+  if (cost < match->best_cost ||
+      (cost == match->best_cost && d < match->best_disparity)) {
+    match->second_best_cost = MIN(match->best_cost, second_cost);
+    match->best_cost = cost;
+    match->best_disparity = d;
+  } else if (cost < match->second_best_cost) {
+    match->second_best_cost = cost;
+  }
+}
+
+// Скалярный эталон: SAD для каждой диспаратности из [d_begin, d_end).
+// Частичная сумма после каждой строки окна сравнивается со второй лучшей
+// стоимостью: суммы только растут, и кандидат, сумма которого уже не меньше
+// второй, не изменит ни лучшую, ни вторую (обе проверки match_merge строгие).
+// Кандидат левее лучшего при равенстве стал бы лучшим, поэтому для него
+// порог на 1 больше. Решения те же, что при полном счете
+void stereobm_match_scalar(const uint8_t *left, const uint8_t *right,
+                           int width, int x, int y, int half_block,
+                           int d_begin, int d_end, StereoBMMatch *match) {
+  for (int d = d_begin; d < d_end; d++) {
+    int right_x = x - d;
+    int sad = 0;
+    long long limit = (long long)match->second_best_cost + (d < match->best_disparity);
+    int bi;
+
+    for (bi = -half_block; bi <= half_block; bi++) {
+      const uint8_t *lrow = left + (y + bi) * width + x;
+      const uint8_t *rrow = right + (y + bi) * width + right_x;
+      for (int bj = -half_block; bj <= half_block; bj++) {
+        sad += abs(lrow[bj] - rrow[bj]);
+      }
+      if (sad >= limit)
+        break;
+    }
+
+    if (bi > half_block)
+      match_merge(match, sad, INT_MAX, d);
+  }
+}
+
+#ifdef STEREOBM_HAVE_X86
+
+// SSE2: 16 диспаратностей за раз. Линия k соответствует d = d0 + 15 - k,
+// поэтому строка правого изображения читается одним невыровненным load.
+// Суммы хранятся в 16-битных линиях со смещением 0x8000, так как в SSE2
+// есть только знаковый _mm_min_epi16.
+static inline __m128i hmin_epi16(__m128i v) {
+  v = _mm_min_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_min_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  v = _mm_min_epi16(v, _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_shuffle_epi32(_mm_shufflelo_epi16(v, 0), 0);
+}
+
+// Тело ядра встраивается в обобщенный вариант и в специализации под
+// конкретный half_block (см. STEREOBM_HALF_BLOCKS ниже). В специализациях
+// (fixed != 0) границы окна - константы, и столбцы окна обрабатываются
+// парами: разность пикселей не больше 2 * pre_filter_cap <= 126, так что
+// сумма пары помещается в 8-битную линию и расширяется до 16 бит один раз.
+static inline __attribute__((always_inline))
+void match_sse2_body(const uint8_t *left, const uint8_t *right,
+                     int width, int x, int y, int half_block, const int fixed,
+                     int d_begin, int d_end, StereoBMMatch *match) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias = _mm_set1_epi16((short)0x8000);
+  int d0;
+
+  for (d0 = d_begin; d0 + 16 <= d_end; d0 += 16) {
+    __m128i lo = bias, hi = bias;
+
+    for (int bi = -half_block; bi <= half_block; bi++) {
+      const uint8_t *lrow = left + (y + bi) * width + x;
+      const uint8_t *rrow = right + (y + bi) * width + x - d0 - 15;
+      int bj = -half_block;
+      for (; fixed && bj < half_block; bj += 2) {
+        __m128i lv0 = _mm_set1_epi8((char)lrow[bj]);
+        __m128i lv1 = _mm_set1_epi8((char)lrow[bj + 1]);
+        __m128i rv0 = _mm_loadu_si128((const __m128i *)(rrow + bj));
+        __m128i rv1 = _mm_loadu_si128((const __m128i *)(rrow + bj + 1));
+        __m128i diff = _mm_add_epi8(_mm_or_si128(_mm_subs_epu8(lv0, rv0), _mm_subs_epu8(rv0, lv0)),
+                                    _mm_or_si128(_mm_subs_epu8(lv1, rv1), _mm_subs_epu8(rv1, lv1)));
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(diff, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(diff, zero));
+      }
+      for (; bj <= half_block; bj++) {
+        __m128i lv = _mm_set1_epi8((char)lrow[bj]);
+        __m128i rv = _mm_loadu_si128((const __m128i *)(rrow + bj));
+        __m128i diff = _mm_or_si128(_mm_subs_epu8(lv, rv), _mm_subs_epu8(rv, lv));
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(diff, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(diff, zero));
+      }
+    }
+
+    // Минимум блока и его линии
+    __m128i minv = hmin_epi16(_mm_min_epi16(lo, hi));
+    __m128i eq_lo = _mm_cmpeq_epi16(lo, minv);
+    __m128i eq_hi = _mm_cmpeq_epi16(hi, minv);
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_packs_epi16(eq_lo, eq_hi));
+    int cost = (_mm_cvtsi128_si32(minv) & 0xFFFF) ^ 0x8000;
+
+    // Наименьшая диспаратность - старшая линия
+    int lane = 31 - __builtin_clz(mask);
+    int second_cost = cost;
+    if (__builtin_popcount(mask) == 1) {
+      const __m128i top = _mm_set1_epi16(0x7FFF);
+      __m128i lo2 = _mm_or_si128(_mm_andnot_si128(eq_lo, lo), _mm_and_si128(eq_lo, top));
+      __m128i hi2 = _mm_or_si128(_mm_andnot_si128(eq_hi, hi), _mm_and_si128(eq_hi, top));
+      second_cost = (_mm_cvtsi128_si32(hmin_epi16(_mm_min_epi16(lo2, hi2))) & 0xFFFF) ^ 0x8000;
+    }
+
+    match_merge(match, cost, second_cost, d0 + 15 - lane);
+  }
+
+  stereobm_match_scalar(left, right, width, x, y, half_block, d0, d_end, match);
+}
+
+void stereobm_match_sse2(const uint8_t *left, const uint8_t *right,
+                         int width, int x, int y, int half_block,
+                         int d_begin, int d_end, StereoBMMatch *match) {
+  match_sse2_body(left, right, width, x, y, half_block, 0, d_begin, d_end, match);
+}
+
+// AVX2: 32 диспаратности за раз. unpacklo/unpackhi и packs работают внутри
+// 128-битных половин, поэтому после packs порядок байтов в маске снова
+// совпадает с порядком линий загрузки.
+__attribute__((target("avx2"))) static inline __attribute__((always_inline))
+void match_avx2_body(const uint8_t *left, const uint8_t *right,
+                     int width, int x, int y, int half_block, const int fixed,
+                     int d_begin, int d_end, StereoBMMatch *match) {
+  const __m256i zero = _mm256_setzero_si256();
+  int d0;
+
+  for (d0 = d_begin; d0 + 32 <= d_end; d0 += 32) {
+    __m256i lo = zero, hi = zero;
+
+    for (int bi = -half_block; bi <= half_block; bi++) {
+      const uint8_t *lrow = left + (y + bi) * width + x;
+      const uint8_t *rrow = right + (y + bi) * width + x - d0 - 31;
+      int bj = -half_block;
+      for (; fixed && bj < half_block; bj += 2) {
+        __m256i lv0 = _mm256_set1_epi8((char)lrow[bj]);
+        __m256i lv1 = _mm256_set1_epi8((char)lrow[bj + 1]);
+        __m256i rv0 = _mm256_loadu_si256((const __m256i *)(rrow + bj));
+        __m256i rv1 = _mm256_loadu_si256((const __m256i *)(rrow + bj + 1));
+        __m256i diff = _mm256_add_epi8(
+            _mm256_or_si256(_mm256_subs_epu8(lv0, rv0), _mm256_subs_epu8(rv0, lv0)),
+            _mm256_or_si256(_mm256_subs_epu8(lv1, rv1), _mm256_subs_epu8(rv1, lv1)));
+        lo = _mm256_add_epi16(lo, _mm256_unpacklo_epi8(diff, zero));
+        hi = _mm256_add_epi16(hi, _mm256_unpackhi_epi8(diff, zero));
+      }
+      for (; bj <= half_block; bj++) {
+        __m256i lv = _mm256_set1_epi8((char)lrow[bj]);
+        __m256i rv = _mm256_loadu_si256((const __m256i *)(rrow + bj));
+        __m256i diff = _mm256_or_si256(_mm256_subs_epu8(lv, rv), _mm256_subs_epu8(rv, lv));
+        lo = _mm256_add_epi16(lo, _mm256_unpacklo_epi8(diff, zero));
+        hi = _mm256_add_epi16(hi, _mm256_unpackhi_epi8(diff, zero));
+      }
+    }
+
+    __m256i m = _mm256_min_epu16(lo, hi);
+    __m128i m128 = _mm_min_epu16(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1));
+    int cost = _mm_cvtsi128_si32(_mm_minpos_epu16(m128)) & 0xFFFF;
+
+    __m256i minv = _mm256_set1_epi16((short)cost);
+    __m256i eq_lo = _mm256_cmpeq_epi16(lo, minv);
+    __m256i eq_hi = _mm256_cmpeq_epi16(hi, minv);
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_packs_epi16(eq_lo, eq_hi));
+
+    int lane = 31 - __builtin_clz(mask);
+    int second_cost = cost;
+    if (__builtin_popcount(mask) == 1) {
+      __m256i m2 = _mm256_min_epu16(_mm256_or_si256(lo, eq_lo), _mm256_or_si256(hi, eq_hi));
+      __m128i m2_128 = _mm_min_epu16(_mm256_castsi256_si128(m2), _mm256_extracti128_si256(m2, 1));
+      second_cost = _mm_cvtsi128_si32(_mm_minpos_epu16(m2_128)) & 0xFFFF;
+    }
+
+    match_merge(match, cost, second_cost, d0 + 31 - lane);
+  }
+
+  // Остаток (кратный 16 внутри изображения) - через SSE2
+  match_sse2_body(left, right, width, x, y, half_block, fixed, d0, d_end, match);
+}
+
+__attribute__((target("avx2")))
+void stereobm_match_avx2(const uint8_t *left, const uint8_t *right,
+                         int width, int x, int y, int half_block,
+                         int d_begin, int d_end, StereoBMMatch *match) {
+  match_avx2_body(left, right, width, x, y, half_block, 0, d_begin, d_end, match);
+}
+
+// Специализации для block_size 3..21 (диапазон диалога): half_block -
+// константа, циклы окна имеют известное число итераций и разворачиваются
+// компилятором, смещения столбцов окна входят в адреса загрузок.
+#define STEREOBM_HALF_BLOCKS(X) X(1) X(2) X(3) X(4) X(5) X(6) X(7) X(8) X(9) X(10)
+
+#define STEREOBM_SPECIALIZE(HB) \
+  static void match_sse2_hb##HB(const uint8_t *left, const uint8_t *right, \
+                                int width, int x, int y, int half_block, \
+                                int d_begin, int d_end, StereoBMMatch *match) { \
+    (void)half_block; \
+    match_sse2_body(left, right, width, x, y, HB, 1, d_begin, d_end, match); \
+  } \
+  __attribute__((target("avx2"))) \
+  static void match_avx2_hb##HB(const uint8_t *left, const uint8_t *right, \
+                                int width, int x, int y, int half_block, \
+                                int d_begin, int d_end, StereoBMMatch *match) { \
+    (void)half_block; \
+    match_avx2_body(left, right, width, x, y, HB, 1, d_begin, d_end, match); \
+  }
+STEREOBM_HALF_BLOCKS(STEREOBM_SPECIALIZE)
+
+// Таблицы ядер по half_block (0 - обобщенное ядро)
+#define STEREOBM_SSE2_ENTRY(HB) match_sse2_hb##HB,
+#define STEREOBM_AVX2_ENTRY(HB) match_avx2_hb##HB,
+static const StereoBMMatchFunc sse2_kernels[] = {
+  stereobm_match_sse2, STEREOBM_HALF_BLOCKS(STEREOBM_SSE2_ENTRY)
+};
+static const StereoBMMatchFunc avx2_kernels[] = {
+  stereobm_match_avx2, STEREOBM_HALF_BLOCKS(STEREOBM_AVX2_ENTRY)
+};
+#define STEREOBM_MAX_SPECIALIZED (int)(sizeof(sse2_kernels) / sizeof(sse2_kernels[0]) - 1)
+// Наибольший pre_filter_cap для 8-битных сумм пар столбцов
+#define STEREOBM_MAX_SPECIALIZED_CAP 63
+
+#endif
+
+// Строка X-Sobel по трем строкам серого: (r[x+1] - r[x-1]) с весами 1, 2, 1,
+// ограничение [-cap, cap] и сдвиг на cap; крайние столбцы - граничное значение
+void stereobm_xsobel_row(const uint8_t *r0, const uint8_t *r1, const uint8_t *r2,
+                         int width, int pre_filter_cap, uint8_t *out) {
+  int x = 1;
+
+  if (width <= 0)
+    return;
+  out[0] = (uint8_t)pre_filter_cap;
+  out[width - 1] = (uint8_t)pre_filter_cap;
+
+#ifdef STEREOBM_HAVE_X86
+  // SSE2 (базовый набор x86-64): 16 пикселей за итерацию в 16-битных линиях
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i cap = _mm_set1_epi16((short)pre_filter_cap);
+  const __m128i neg_cap = _mm_set1_epi16((short)-pre_filter_cap);
+
+  for (; x + 16 <= width - 1; x += 16) {
+    __m128i a0 = _mm_loadu_si128((const __m128i *)(r0 + x - 1));
+    __m128i b0 = _mm_loadu_si128((const __m128i *)(r0 + x + 1));
+    __m128i a1 = _mm_loadu_si128((const __m128i *)(r1 + x - 1));
+    __m128i b1 = _mm_loadu_si128((const __m128i *)(r1 + x + 1));
+    __m128i a2 = _mm_loadu_si128((const __m128i *)(r2 + x - 1));
+    __m128i b2 = _mm_loadu_si128((const __m128i *)(r2 + x + 1));
+
+    __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(b0, zero), _mm_unpacklo_epi8(a0, zero));
+    __m128i d1 = _mm_sub_epi16(_mm_unpacklo_epi8(b1, zero), _mm_unpacklo_epi8(a1, zero));
+    lo = _mm_add_epi16(lo, _mm_add_epi16(d1, d1));
+    lo = _mm_add_epi16(lo, _mm_sub_epi16(_mm_unpacklo_epi8(b2, zero), _mm_unpacklo_epi8(a2, zero)));
+
+    __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(b0, zero), _mm_unpackhi_epi8(a0, zero));
+    d1 = _mm_sub_epi16(_mm_unpackhi_epi8(b1, zero), _mm_unpackhi_epi8(a1, zero));
+    hi = _mm_add_epi16(hi, _mm_add_epi16(d1, d1));
+    hi = _mm_add_epi16(hi, _mm_sub_epi16(_mm_unpackhi_epi8(b2, zero), _mm_unpackhi_epi8(a2, zero)));
+
+    lo = _mm_add_epi16(_mm_min_epi16(_mm_max_epi16(lo, neg_cap), cap), cap);
+    hi = _mm_add_epi16(_mm_min_epi16(_mm_max_epi16(hi, neg_cap), cap), cap);
+    _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(lo, hi));
+  }
+#endif
+
+  for (; x < width - 1; x++) {
+    int val = (r0[x + 1] - r0[x - 1]) + 2 * (r1[x + 1] - r1[x - 1]) + (r2[x + 1] - r2[x - 1]);
+    out[x] = (uint8_t)(CLAMP(val, -pre_filter_cap, pre_filter_cap) + pre_filter_cap);
+  }
+}
+
+// Выбор ядра по CPUID и block_size. 16-битные суммы не переполняются, пока
+// block_size^2 * 2 * pre_filter_cap < 65535 (для диапазонов диалога это так).
+// Развернутые ядра складывают разности двух столбцов в 8-битных лучах:
+// сумма не больше 2 * 2 * pre_filter_cap помещается в байт только при
+// pre_filter_cap <= 63, иначе берется обобщенное ядро.
+static StereoBMMatchFunc select_match_func(const StereoBMParams *params, int specialized) {
+#ifdef STEREOBM_HAVE_X86
+  int max_cost = params->block_size * params->block_size * 2 * params->pre_filter_cap;
+  int half_block = params->block_size / 2;
+  int kernel = 0;
+
+  if (specialized && half_block >= 1 && half_block <= STEREOBM_MAX_SPECIALIZED &&
+      params->pre_filter_cap <= STEREOBM_MAX_SPECIALIZED_CAP)
+    kernel = half_block;
+
+  if (max_cost < 0xFFFF) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return avx2_kernels[kernel];
+    if (__builtin_cpu_supports("sse2"))
+      return sse2_kernels[kernel];
+  }
+#else
+  (void)params;
+  (void)specialized;
+#endif
+  return stereobm_match_scalar;
+}
+
+StereoBMMatchFunc stereobm_select_match_func(const StereoBMParams *params) {
+  return select_match_func(params, 1);
+}
+
+// Обобщенное ядро с half_block времени выполнения (для сравнения в бенчмарке)
+StereoBMMatchFunc stereobm_select_generic_match_func(const StereoBMParams *params) {
+  return select_match_func(params, 0);
+}
+
+// Цветовое кодирование по таблице: colormap[v] - RGB значения карты v
+// (байты R, G, B, 0). Значения вне таблицы получают цвет последнего элемента.
+void stereobm_colormap_scalar(const uint32_t *colormap, const int16_t *disparity_map,
+                              uint8_t *output, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    uint32_t rgb = colormap[MIN((uint16_t)disparity_map[i], STEREOBM_COLORMAP_SIZE - 1)];
+
+    output[i * 3] = (uint8_t)rgb;
+    output[i * 3 + 1] = (uint8_t)(rgb >> 8);
+    output[i * 3 + 2] = (uint8_t)(rgb >> 16);
+  }
+}
+
+#ifdef STEREOBM_HAVE_X86
+// AVX2: 8 пикселей за итерацию - gather из таблицы, в каждой 128-битной
+// половине 4 слова RGB0 сжимаются в 12 байт RGB. Вторая запись выходит на
+// 4 байта за 8 пикселей, поэтому цикл останавливается за 2 пикселя до конца.
+__attribute__((target("avx2")))
+void stereobm_colormap_avx2(const uint32_t *colormap, const int16_t *disparity_map,
+                            uint8_t *output, size_t count) {
+  const __m256i last = _mm256_set1_epi32(STEREOBM_COLORMAP_SIZE - 1);
+  const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  size_t i = 0;
+
+  for (; i + 10 <= count; i += 8) {
+    __m256i index = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(disparity_map + i)));
+    index = _mm256_min_epu32(index, last);
+    __m256i rgb = _mm256_i32gather_epi32((const int *)colormap, index, 4);
+
+    rgb = _mm256_shuffle_epi8(rgb, pack);
+    _mm_storeu_si128((__m128i *)(output + i * 3), _mm256_castsi256_si128(rgb));
+    _mm_storeu_si128((__m128i *)(output + i * 3 + 12), _mm256_extracti128_si256(rgb, 1));
+  }
+
+  stereobm_colormap_scalar(colormap, disparity_map + i, output + i * 3, count - i);
+}
+#endif
+
+StereoBMColormapFunc stereobm_select_colormap_func(void) {
+#ifdef STEREOBM_HAVE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return stereobm_colormap_avx2;
+#endif
+  return stereobm_colormap_scalar;
+}
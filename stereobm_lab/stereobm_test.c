@@ -0,0 +1,352 @@
+#include "stereobm_core.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Проверки ядра (make check собирает их с AddressSanitizer): граничные
+// размеры изображений и параметры, при которых окно поиска может выйти
+// за буферы. Карта проверяется на нули в столбцах, где окно левого вида
+// не помещается в строку.
+
+typedef struct {
+  int width;
+  int height;
+} TestSize;
+
+static const TestSize sizes[] = {
+  { 20, 10 }, { 34, 40 }, { 70, 17 }, { 40, 40 }, { 333, 97 },
+};
+
+// Варианты поверх параметров по умолчанию с texture_threshold = 0
+static void test_config(int config, StereoBMParams *params) {
+  stereobm_params_init(params);
+  params->num_disparities = 16;
+  params->block_size = 5;
+  params->texture_threshold = 0;
+  switch (config) {
+    case 0: params->num_threads = 1; break;
+    case 1: params->num_threads = 3; break;
+    case 2: params->auto_range = 1; break;
+    case 3: params->pyramid_levels = 2; break;
+    case 4: params->cost_type = STEREOBM_COST_CENSUS_5X5; break;
+    case 5: params->cost_type = STEREOBM_COST_CENSUS_7X9; params->block_size = 9; break;
+    case 6: params->disp12_max_diff = 1; break;
+    case 7: params->cache_bytes = 4096; params->num_threads = 2; break;
+    case 8: params->block_size = 21; params->min_disparity = 3; break;
+  }
+}
+#define TEST_CONFIGS 9
+
+// Столбцы за краями окна должны остаться без диспаратности
+static int border_clear(const int16_t *map, int width, int height, int half_block) {
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+      if ((x < half_block || x >= width - half_block) && map[(size_t)y * width + x] != 0)
+        return 0;
+  return 1;
+}
+
+// Развернутые ядра должны совпадать с обобщенным при любом pre_filter_cap
+static int test_match_kernels(int pre_filter_cap) {
+  int width = 96, height = 24, mismatched = 0;
+  uint8_t *left = malloc((size_t)width * height), *right = malloc((size_t)width * height);
+  StereoBMParams params;
+
+  stereobm_params_init(&params);
+  params.block_size = 5;
+  params.pre_filter_cap = pre_filter_cap;
+  for (int i = 0; i < width * height; i++) {
+    left[i] = (uint8_t)(rand() % (2 * pre_filter_cap + 1));
+    right[i] = (uint8_t)(rand() % (2 * pre_filter_cap + 1));
+  }
+
+  StereoBMMatchFunc specialized = stereobm_select_match_func(&params);
+  StereoBMMatchFunc generic = stereobm_select_generic_match_func(&params);
+  for (int y = 2; y < height - 2; y++)
+    for (int x = 2 + 32; x < width - 2; x++) {
+      StereoBMMatch a = { 0, INT32_MAX, INT32_MAX }, b = { 0, INT32_MAX, INT32_MAX };
+      specialized(left, right, width, x, y, 2, 0, 32, &a);
+      generic(left, right, width, x, y, 2, 0, 32, &b);
+      if (a.best_cost != b.best_cost || a.second_best_cost != b.second_best_cost)
+        mismatched++;
+    }
+
+  free(left);
+  free(right);
+  if (mismatched)
+    printf("FAIL pre_filter_cap %d: %d pixels differ between kernels\n", pre_filter_cap,
+           mismatched);
+  return mismatched != 0;
+}
+
+// SGM в буферах контекста (один контекст на все варианты, блок растет и
+// переиспользуется) дает ту же карту, что и отдельный вызов
+static int test_sgm_context(void) {
+  int width = 90, height = 40, failed = 0;
+  size_t count = (size_t)width * height;
+  uint8_t *left = malloc(count), *right = malloc(count);
+  StereoBMContext *context = stereobm_context_new();
+
+  for (size_t i = 0; i < count; i++) {
+    left[i] = (uint8_t)rand();
+    right[i] = (uint8_t)(i % width > 3 ? left[i - 3] : rand());
+  }
+
+  for (int config = 0; config < 5; config++) {
+    StereoBMParams params;
+    stereobm_params_init(&params);
+    params.num_disparities = 32;
+    params.block_size = 5;
+    params.sgm_paths = config % 2 ? 8 : 4;
+    params.auto_range = config == 2;
+    params.cost_type = config == 3 ? STEREOBM_COST_CENSUS_5X5 : STEREOBM_COST_SAD;
+    params.disp12_max_diff = config == 4 ? 1 : -1;
+
+    int16_t *map = stereobm_compute(left, right, width, height, &params, NULL, NULL);
+    const int16_t *context_map = stereobm_context_compute(context, left, right, width, 1, width,
+                                                          height, &params, NULL, NULL, NULL);
+    if (memcmp(map, context_map, count * sizeof(int16_t)) != 0) {
+      printf("FAIL SGM config %d: context map differs\n", config);
+      failed++;
+    }
+    free(map);
+  }
+
+  stereobm_context_free(context);
+  free(left);
+  free(right);
+  return failed;
+}
+
+// Столбцы [x_begin, x_end) карты по части изображения, обрезанной, как
+// область выделения в плагине: поле stereobm_column_margin() и диапазон
+// диспаратностей, левый край выровнен по масштабу грубого уровня
+static int16_t *crop_compute(const uint8_t *left_filtered, const uint8_t *right_filtered,
+                             int width, int height, int x_begin, int x_end,
+                             const StereoBMParams *params, int *crop_x, int *crop_width) {
+  int margin = stereobm_column_margin(params) + 1;
+  int max_disparity = params->min_disparity + params->num_disparities - 1;
+  int right_margin = margin + (params->disp12_max_diff >= 0 ? max_disparity : 0);
+  int first = x_begin - margin - max_disparity > 0 ? x_begin - margin - max_disparity : 0;
+  int last = x_end + right_margin < width ? x_end + right_margin : width;
+
+  first &= ~((1 << params->pyramid_levels) - 1);
+  size_t count = (size_t)(last - first) * height;
+  uint8_t *left = malloc(count), *right = malloc(count);
+  for (int y = 0; y < height; y++) {
+    memcpy(left + (size_t)y * (last - first), left_filtered + (size_t)y * width + first,
+           last - first);
+    memcpy(right + (size_t)y * (last - first), right_filtered + (size_t)y * width + first,
+           last - first);
+  }
+
+  int16_t *map = stereobm_compute_filtered(left, right, last - first, height, params, NULL,
+                                           NULL, NULL);
+  free(left);
+  free(right);
+  *crop_x = first;
+  *crop_width = last - first;
+  return map;
+}
+
+// Поиск полосами (каждая - в буфере ровно из своих строк с полями
+// stereobm_band_margin()) и по обрезанным столбцам дает ту же карту, что и
+// по всему изображению, в том числе с грубыми уровнями пирамиды
+static int test_bands(void) {
+  int width = 120, height = 91, band = 13, failed = 0;
+  size_t count = (size_t)width * height;
+  uint8_t *left = malloc(count), *right = malloc(count);
+  uint8_t *left_filtered = malloc(count), *right_filtered = malloc(count);
+  int16_t *banded = malloc(count * sizeof(int16_t));
+
+  for (size_t i = 0; i < count; i++) {
+    left[i] = (uint8_t)rand();
+    right[i] = (uint8_t)(i % width > 6 ? left[i - 6] : rand());
+  }
+
+  for (int config = 0; config < 9; config++) {
+    StereoBMParams params;
+    stereobm_params_init(&params);
+    params.num_disparities = 32;
+    params.block_size = 5;
+    params.num_threads = 1;
+    params.pyramid_levels = config % 3;
+    params.cost_type = (StereoBMCostType)(config / 3);
+    if (params.cost_type == STEREOBM_COST_CENSUS_7X9)
+      params.block_size = 7;
+
+    prefilter_xsobel(left, left_filtered, width, height, params.pre_filter_cap);
+    prefilter_xsobel(right, right_filtered, width, height, params.pre_filter_cap);
+    int16_t *map = stereobm_compute_filtered(left_filtered, right_filtered, width, height,
+                                             &params, NULL, NULL, NULL);
+    int margin = stereobm_band_margin(&params);
+
+    for (int y_begin = 0; y_begin < height; y_begin += band) {
+      int y_end = y_begin + band < height ? y_begin + band : height;
+      int first = y_begin > margin ? y_begin - margin : 0;
+      int last = y_end + margin < height ? y_end + margin : height;
+      size_t band_size = (size_t)width * (last - first);
+      uint8_t *left_band = malloc(band_size), *right_band = malloc(band_size);
+
+      memcpy(left_band, left_filtered + (size_t)first * width, band_size);
+      memcpy(right_band, right_filtered + (size_t)first * width, band_size);
+      stereobm_compute_band(left_band, right_band, width, height, first, y_begin, y_end,
+                            &params, banded + (size_t)y_begin * width, NULL, NULL, NULL,
+                            NULL, NULL);
+      free(left_band);
+      free(right_band);
+    }
+
+    if (memcmp(map, banded, count * sizeof(int16_t)) != 0) {
+      printf("FAIL bands config %d: banded map differs from the whole image\n", config);
+      failed++;
+    }
+
+    int x_begin = 53, x_end = 81, crop_x, crop_width;
+    int16_t *cropped = crop_compute(left_filtered, right_filtered, width, height, x_begin,
+                                    x_end, &params, &crop_x, &crop_width);
+    for (int y = 0; y < height; y++)
+      if (memcmp(map + (size_t)y * width + x_begin,
+                 cropped + (size_t)y * crop_width + (x_begin - crop_x),
+                 (x_end - x_begin) * sizeof(int16_t)) != 0) {
+        printf("FAIL bands config %d: cropped map differs from the whole image\n", config);
+        failed++;
+        break;
+      }
+    free(cropped);
+    free(map);
+  }
+
+  free(left);
+  free(right);
+  free(left_filtered);
+  free(right_filtered);
+  free(banded);
+  return failed;
+}
+
+// Оценка диапазона, накопленная по окнам отдельных строк сетки (как в
+// плагине), совпадает с оценкой по всем строкам области
+static int test_range_rows(void) {
+  int width = 160, height = 75, y_begin = 13, y_end = 62, failed = 0;
+  size_t count = (size_t)width * height;
+  uint8_t *left = malloc(count), *right = malloc(count);
+  uint8_t *left_filtered = malloc(count), *right_filtered = malloc(count);
+
+  for (size_t i = 0; i < count; i++)
+    left[i] = (uint8_t)rand();
+  for (size_t i = 0; i < count; i++)
+    right[i] = (uint8_t)(i % width < (size_t)width - 9 ? left[i + 9] : rand());
+
+  for (int block_size = 5; block_size <= 9; block_size += 4) {
+    StereoBMParams params, whole, rows;
+    stereobm_params_init(&params);
+    params.num_disparities = 64;
+    params.block_size = block_size;
+    params.auto_range = 1;
+    int half_block = block_size / 2;
+
+    prefilter_xsobel(left, left_filtered, width, height, params.pre_filter_cap);
+    prefilter_xsobel(right, right_filtered, width, height, params.pre_filter_cap);
+    stereobm_estimate_range(left_filtered, right_filtered, width, height, 0, y_begin, y_end,
+                            &params, &whole);
+
+    int *histogram = calloc(params.num_disparities, sizeof(int));
+    int samples = 0;
+    for (int y = stereobm_range_grid_row(&params, y_begin); y < y_end; y += STEREOBM_RANGE_GRID) {
+      size_t window = (size_t)width * block_size;
+      uint8_t *left_window = malloc(window), *right_window = malloc(window);
+
+      memcpy(left_window, left_filtered + (size_t)(y - half_block) * width, window);
+      memcpy(right_window, right_filtered + (size_t)(y - half_block) * width, window);
+      samples += stereobm_range_sample(left_window, right_window, width, height, y - half_block,
+                                       y, y + 1, &params, histogram);
+      free(left_window);
+      free(right_window);
+    }
+    stereobm_range_finish(histogram, samples, &params, &rows);
+    free(histogram);
+
+    if (rows.min_disparity != whole.min_disparity ||
+        rows.num_disparities != whole.num_disparities ||
+        whole.num_disparities == params.num_disparities) {
+      printf("FAIL range block %d: %d+%d by grid rows, %d+%d by the region\n", block_size,
+             rows.min_disparity, rows.num_disparities, whole.min_disparity,
+             whole.num_disparities);
+      failed++;
+    }
+  }
+
+  free(left);
+  free(right);
+  free(left_filtered);
+  free(right_filtered);
+  return failed;
+}
+
+int main(void) {
+  int failed = 0;
+
+  srand(1);
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    int width = sizes[s].width, height = sizes[s].height;
+    size_t count = (size_t)width * height;
+    // Точные размеры буферов: выход за них ловит AddressSanitizer
+    uint8_t *left = malloc(count), *right = malloc(count);
+    uint8_t *left_filtered = malloc(count), *right_filtered = malloc(count);
+    int16_t *validated = malloc(count * sizeof(int16_t));
+
+    for (size_t i = 0; i < count; i++) {
+      left[i] = (uint8_t)rand();
+      right[i] = (uint8_t)rand();
+    }
+
+    for (int config = 0; config < TEST_CONFIGS; config++) {
+      StereoBMParams params;
+      test_config(config, &params);
+      int half_block = params.block_size / 2;
+
+      int16_t *map = stereobm_compute(left, right, width, height, &params, NULL, NULL);
+      if (!border_clear(map, width, height, half_block)) {
+        printf("FAIL %dx%d config %d: disparity outside the window columns\n",
+               width, height, config);
+        failed++;
+      }
+      free(map);
+
+      // Кэш предпросмотра ищет все пиксели независимо от порога текстуры
+      StereoBMMatchCache cache = { 0 };
+      prefilter_xsobel(left, left_filtered, width, height, params.pre_filter_cap);
+      prefilter_xsobel(right, right_filtered, width, height, params.pre_filter_cap);
+      stereobm_cache_compute(left_filtered, right_filtered, width, height, &params, NULL, &cache);
+      stereobm_cache_validate(&cache, &params, validated);
+      if (!border_clear(validated, width, height, half_block)) {
+        printf("FAIL %dx%d config %d: cache disparity outside the window columns\n",
+               width, height, config);
+        failed++;
+      }
+      stereobm_cache_free(&cache);
+
+      StereoBMContext *context = stereobm_context_new();
+      stereobm_context_compute(context, left, right, width, 1, width, height, &params,
+                               NULL, NULL, NULL);
+      stereobm_context_free(context);
+    }
+
+    free(left);
+    free(right);
+    free(left_filtered);
+    free(right_filtered);
+    free(validated);
+  }
+
+  failed += test_sgm_context();
+  failed += test_bands();
+  failed += test_range_rows();
+  failed += test_match_kernels(63);
+  failed += test_match_kernels(100);
+
+  if (failed == 0)
+    printf("OK\n");
+  return failed ? 1 : 0;
+}
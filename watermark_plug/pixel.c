@@ -1,46 +1,185 @@
 #include "pixel.h"
 #include <math.h>
+#include <string.h>
 #include "watermark_logic.h"
 
 
-// Наложение с учетом прозрачности (alpha blending)
+// Наложение с учетом прозрачности (alpha blending) в целых числах:
+// a = alpha * opacity / 255, результат = (overlay * a + base * (255 - a)) / 255,
+// деление на 255 с округлением без деления (div255). Полностью прозрачный
+// пиксель дает исходное значение без отдельной проверки.
+static inline guint div255(guint x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Эталонное скалярное ядро: count пикселей строки, base - RGB, overlay - RGBA
+void blend_row_scalar(guchar *base, const guchar *overlay, gint count, guint opacity)
+{
+    for (gint x = 0; x < count; x++) {
+        guint alpha = div255(overlay[x * 4 + 3] * opacity);
+
+        for (gint c = 0; c < 3; c++)
+            base[x * 3 + c] = div255(overlay[x * 4 + c] * alpha + base[x * 3 + c] * (255 - alpha));
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// Векторные ядра: в каждой 128-битной линии 4 пикселя - 16 байт RGBA
+// водяного знака и 12 байт RGB изображения. pshufb раскладывает RGBA в RGB
+// и размножает альфу на каналы, дальше 16-битная арифметика по 8 значений;
+// div255(x) = ((x + 128) * 257) >> 16 (mulhi), точно как в скалярном ядре.
+// Строки изображения читаются и пишутся ровно по 12 байт, без выхода за буфер.
+
+__attribute__((target("sse4.1")))
+static inline __m128i blend_load12(const guchar *p)
+{
+    gint32 tail;
+    memcpy(&tail, p + 8, 4);
+    return _mm_insert_epi32(_mm_loadl_epi64((const __m128i *)p), tail, 2);
+}
+
+__attribute__((target("sse4.1")))
+static inline void blend_store12(guchar *p, __m128i v)
+{
+    gint32 tail = _mm_extract_epi32(v, 2);
+    _mm_storel_epi64((__m128i *)p, v);
+    memcpy(p + 8, &tail, 4);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i blend_div255_sse(__m128i x)
+{
+    return _mm_mulhi_epu16(_mm_add_epi16(x, _mm_set1_epi16(128)), _mm_set1_epi16(257));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i blend_mix_sse(__m128i over, __m128i alpha, __m128i base, __m128i opacity)
+{
+    __m128i a = blend_div255_sse(_mm_mullo_epi16(alpha, opacity));
+    __m128i inv = _mm_sub_epi16(_mm_set1_epi16(255), a);
+    return blend_div255_sse(_mm_add_epi16(_mm_mullo_epi16(over, a), _mm_mullo_epi16(base, inv)));
+}
+
+__attribute__((target("sse4.1")))
+static void blend_row_sse41(guchar *base, const guchar *overlay, gint count, guint opacity)
+{
+    const __m128i rgb_mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m128i alpha_mask = _mm_setr_epi8(3, 3, 3, 7, 7, 7, 11, 11, 11, 15, 15, 15,
+                                             -1, -1, -1, -1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i op = _mm_set1_epi16((short)opacity);
+    gint x = 0;
+
+    for (; x + 4 <= count; x += 4) {
+        __m128i ov = _mm_loadu_si128((const __m128i *)(overlay + x * 4));
+        __m128i rgb = _mm_shuffle_epi8(ov, rgb_mask);
+        __m128i alpha = _mm_shuffle_epi8(ov, alpha_mask);
+        __m128i b = blend_load12(base + x * 3);
+
+        __m128i lo = blend_mix_sse(_mm_unpacklo_epi8(rgb, zero), _mm_unpacklo_epi8(alpha, zero),
+                                   _mm_unpacklo_epi8(b, zero), op);
+        __m128i hi = blend_mix_sse(_mm_unpackhi_epi8(rgb, zero), _mm_unpackhi_epi8(alpha, zero),
+                                   _mm_unpackhi_epi8(b, zero), op);
+        blend_store12(base + x * 3, _mm_packus_epi16(lo, hi));
+    }
+    blend_row_scalar(base + x * 3, overlay + x * 4, count - x, opacity);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blend_div255_avx2(__m256i x)
+{
+    return _mm256_mulhi_epu16(_mm256_add_epi16(x, _mm256_set1_epi16(128)), _mm256_set1_epi16(257));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blend_mix_avx2(__m256i over, __m256i alpha, __m256i base, __m256i opacity)
+{
+    __m256i a = blend_div255_avx2(_mm256_mullo_epi16(alpha, opacity));
+    __m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+    return blend_div255_avx2(_mm256_add_epi16(_mm256_mullo_epi16(over, a),
+                                              _mm256_mullo_epi16(base, inv)));
+}
+
+// То же по 8 пикселей: pshufb и распаковка в AVX2 работают внутри линий,
+// поэтому каждая линия - отдельная четверка пикселей
+__attribute__((target("avx2")))
+static void blend_row_avx2(guchar *base, const guchar *overlay, gint count, guint opacity)
+{
+    const __m256i rgb_mask = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                              0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i alpha_mask = _mm256_setr_epi8(3, 3, 3, 7, 7, 7, 11, 11, 11, 15, 15, 15,
+                                                -1, -1, -1, -1,
+                                                3, 3, 3, 7, 7, 7, 11, 11, 11, 15, 15, 15,
+                                                -1, -1, -1, -1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i op = _mm256_set1_epi16((short)opacity);
+    gint x = 0;
+
+    for (; x + 8 <= count; x += 8) {
+        __m256i ov = _mm256_loadu_si256((const __m256i *)(overlay + x * 4));
+        __m256i rgb = _mm256_shuffle_epi8(ov, rgb_mask);
+        __m256i alpha = _mm256_shuffle_epi8(ov, alpha_mask);
+        __m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(blend_load12(base + x * 3)),
+                                            blend_load12(base + x * 3 + 12), 1);
+
+        __m256i lo = blend_mix_avx2(_mm256_unpacklo_epi8(rgb, zero),
+                                    _mm256_unpacklo_epi8(alpha, zero),
+                                    _mm256_unpacklo_epi8(b, zero), op);
+        __m256i hi = blend_mix_avx2(_mm256_unpackhi_epi8(rgb, zero),
+                                    _mm256_unpackhi_epi8(alpha, zero),
+                                    _mm256_unpackhi_epi8(b, zero), op);
+        __m256i out = _mm256_packus_epi16(lo, hi);
+        blend_store12(base + x * 3, _mm256_castsi256_si128(out));
+        blend_store12(base + x * 3 + 12, _mm256_extracti128_si256(out, 1));
+    }
+    blend_row_sse41(base + x * 3, overlay + x * 4, count - x, opacity);
+}
+#endif
+
+// Ядро выбирается один раз по возможностям процессора
+BlendRowFunc blend_row_select(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return blend_row_avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return blend_row_sse41;
+#endif
+    return blend_row_scalar;
+}
+
 void blend_layers(guchar *base_pixels, guchar *overlay_pixels, 
                   gint width, gint height, gint bpp,
                   gdouble opacity, gint overlay_x, gint overlay_y,
                   gint overlay_width, gint overlay_height)
 {
+    static BlendRowFunc blend_row = NULL;
+    if (g_once_init_enter(&blend_row))
+        g_once_init_leave(&blend_row, blend_row_select());
+
+    // Общая прозрачность в 0..255
+    guint opacity_u8 = (guint)lround(CLAMP(opacity, 0.0, 1.0) * 255.0);
+
+    // Часть водяного знака внутри изображения
+    gint x_begin = MAX(0, -overlay_x);
+    gint x_end = MIN(overlay_width, width - overlay_x);
+    gint y_begin = MAX(0, -overlay_y);
+    gint y_end = MIN(overlay_height, height - overlay_y);
+    if (x_begin >= x_end || opacity_u8 == 0)
+        return;
+
     // Цикл по строкам накладываемого изображения
-    for (gint y = 0; y < overlay_height; y++) {
-        gint base_y = overlay_y + y;
-        if (base_y < 0 || base_y >= height) continue;
-        
-        // Цикл по столбцам накладываемого изображения
-        for (gint x = 0; x < overlay_width; x++) {
-            gint base_x = overlay_x + x;
-            if (base_x < 0 || base_x >= width) continue;
-            
-            // Расчет индексов для доступа к пикселям
-            gint base_idx = (base_y * width + base_x) * 3;  // Базовое изображение RGB (3 канала)
-            gint overlay_idx = (y * overlay_width + x) * 4; // Накладываемое изображение RGBA (4 канала)
-            
-            // Расчет альфа-канала с учетом общей прозрачности
-            gdouble overlay_alpha = overlay_pixels[overlay_idx + 3] / 255.0;
-            gdouble final_alpha = opacity * overlay_alpha;
+    for (gint y = y_begin; y < y_end; y++) {
+        // Базовое изображение RGB (3 канала), накладываемое - RGBA (4 канала)
+        guchar *base_row = base_pixels + ((gsize)(overlay_y + y) * width + overlay_x + x_begin) * 3;
+        const guchar *overlay_row = overlay_pixels + ((gsize)y * overlay_width + x_begin) * 4;
 
-            // Пропуск полностью прозрачных пикселей
-            if (overlay_pixels[overlay_idx + 3] == 0) continue;
-            
-            // Наложение для каждого цветового канала (R, G, B)
-            for (gint c = 0; c < 3; c++) {
-                gdouble base_val = base_pixels[base_idx + c];
-                gdouble overlay_val = overlay_pixels[overlay_idx + c];
-                
-                // Формула alpha blending
-                gdouble blended = overlay_val * final_alpha + base_val * (1.0 - final_alpha);
-                // Ограничение значения и запись результата
-                base_pixels[base_idx + c] = (guchar)CLAMP(blended, 0, 255);
-            }
-        }
+        blend_row(base_row, overlay_row, x_end - x_begin, opacity_u8);
     }
 }
 
@@ -222,15 +361,6 @@ gboolean apply_single_image_watermark_pixel_level(GimpImage *image, GimpDrawable
     // Получение размеров основного изображения
     gint image_width = gimp_drawable_get_width(drawable);
     gint image_height = gimp_drawable_get_height(drawable);
-    
-    // Получаем буфер основного изображения
-    GeglBuffer *buffer = gimp_drawable_get_buffer(drawable);
-    guchar *image_pixels = g_malloc(image_width * image_height * 3);
-    
-    // Чтение пикселей из буфера в массив
-    gegl_buffer_get(buffer, GEGL_RECTANGLE(0, 0, image_width, image_height), 1.0,
-                   babl_format("R'G'B' u8"), image_pixels,
-                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);    
 
     // Загружаем водяной знак
     guchar *watermark_pixels = NULL;
@@ -239,8 +369,6 @@ gboolean apply_single_image_watermark_pixel_level(GimpImage *image, GimpDrawable
     // Проверка успешности загрузки
     if (!load_watermark_pixels(params->image_path, &watermark_pixels, 
                               &wm_width, &wm_height, &wm_bpp)) {
-        g_free(image_pixels);
-        g_object_unref(buffer);
         return FALSE;
     }
     
@@ -274,20 +402,36 @@ gboolean apply_single_image_watermark_pixel_level(GimpImage *image, GimpDrawable
     calculate_single_position(image_width, image_height, wm_width, wm_height, 
                              params->position_type, params->custom_x, params->custom_y,
                              &pos_x, &pos_y);
+
+    // Область изображения под водяным знаком: читаются, пишутся и
+    // обновляются только ее пиксели
+    GeglRectangle area = { pos_x, pos_y, wm_width, wm_height };
+    GeglRectangle bounds = { 0, 0, image_width, image_height };
+    if (!gegl_rectangle_intersect(&area, &area, &bounds)) {
+        g_free(watermark_pixels);
+        return TRUE;
+    }
+
+    // Получаем буфер основного изображения
+    GeglBuffer *buffer = gimp_drawable_get_buffer(drawable);
+    guchar *area_pixels = g_malloc((gsize)area.width * area.height * 3);
+    
+    // Чтение пикселей области в массив
+    gegl_buffer_get(buffer, &area, 1.0, babl_format("R'G'B' u8"), area_pixels,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
     
-    // Накладываем водяной знак
-    blend_layers(image_pixels, watermark_pixels, image_width, image_height, 3,
-                params->opacity, pos_x, pos_y, wm_width, wm_height);
+    // Накладываем водяной знак (координаты - относительно области)
+    blend_layers(area_pixels, watermark_pixels, area.width, area.height, 3,
+                params->opacity, pos_x - area.x, pos_y - area.y, wm_width, wm_height);
     
-    // Сохраняем результат обратно в буфер
-    gegl_buffer_set(buffer, GEGL_RECTANGLE(0, 0, image_width, image_height), 0,
-                   babl_format("RGB u8"), image_pixels,
+    // Сохраняем результат обратно в буфер (в том же формате, что при чтении)
+    gegl_buffer_set(buffer, &area, 0, babl_format("R'G'B' u8"), area_pixels,
                    GEGL_AUTO_ROWSTRIDE);
     
     // Обновляем изображение
-    gimp_drawable_update(drawable, 0, 0, image_width, image_height);
+    gimp_drawable_update(drawable, area.x, area.y, area.width, area.height);
     
-    g_free(image_pixels);
+    g_free(area_pixels);
     g_free(watermark_pixels);
     g_object_unref(buffer);
     
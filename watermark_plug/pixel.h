@@ -4,6 +4,15 @@
 #include <libgimp/gimp.h>
 #include "ui.h"
 
+// Ядро смешения строки: count пикселей, base - RGB, overlay - RGBA,
+// opacity - общая прозрачность 0..255
+typedef void (*BlendRowFunc)(guchar *base, const guchar *overlay, gint count, guint opacity);
+
+// Скалярное эталонное ядро и выбор ядра (AVX2, SSE4.1 или скалярное)
+// по возможностям процессора; результаты всех ядер совпадают побитно
+void blend_row_scalar(guchar *base, const guchar *overlay, gint count, guint opacity);
+BlendRowFunc blend_row_select(void);
+
 // Функция наложения слоев с альфа-смешением
 void blend_layers(guchar *base_pixels, guchar *overlay_pixels, 
                   gint width, gint height, gint bpp,